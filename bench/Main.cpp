@@ -0,0 +1,103 @@
+#include "Pcheader.h"
+
+#include <nwork/API.h>
+
+namespace nwork_bench
+{
+
+	namespace
+	{
+
+		struct Mode
+		{
+			const char*					m_name = NULL;
+			nwork::Queue::WakePolicy	m_wakePolicy = nwork::Queue::WAKE_POLICY_ANY;
+			std::chrono::microseconds	m_spinBudget = std::chrono::microseconds(0);
+		};
+
+		// Posts one function at a time and measures how long it takes before a worker starts executing it. Workers 
+		// have time to go idle between posts, so this includes waking them up (or not, when busy polling).
+		void
+		_MeasurePostToExecuteLatency(
+			const Mode&					aMode,
+			size_t						aNumThreads,
+			size_t						aNumSamples,
+			std::chrono::microseconds	aInterval)
+		{
+			nwork::Queue workQueue;
+
+			nwork::ThreadPool::Options options;
+			options.m_numThreads = aNumThreads;
+			options.m_wakePolicy = aMode.m_wakePolicy;
+			options.m_spinBudget = aMode.m_spinBudget;
+			nwork::ThreadPool threadPool(&workQueue, options);
+
+			// Nanoseconds
+			std::vector<int64_t> latencies(aNumSamples);
+
+			for(size_t i = 0; i < aNumSamples; i++)
+			{
+				std::atomic_bool done = false;
+				std::chrono::steady_clock::time_point postTime = std::chrono::steady_clock::now();
+
+				workQueue.PostFunction([&latencies, &done, postTime, i]()
+				{
+					latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - postTime).count();
+					done = true;
+				});
+
+				while(!done)
+					std::this_thread::yield();
+
+				std::this_thread::sleep_for(aInterval);
+			}
+
+			std::sort(latencies.begin(), latencies.end());
+
+			auto percentile = [&latencies](
+				double		aPercentile) -> double
+			{
+				return (double)latencies[(size_t)(aPercentile * (double)(latencies.size() - 1))] / 1000.0;
+			};
+
+			printf("%-12s p50 %9.1f us  p90 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us\n", 
+				aMode.m_name, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(1.0));
+		}
+
+	}
+
+	void
+	Run(
+		size_t							aNumSamples)
+	{
+		// Leave a CPU for the posting thread, spinning workers would compete with it otherwise
+		size_t numThreads = std::min<size_t>(std::max<size_t>(nwork::GetCPUCount(), 2) - 1, 4);
+
+		printf("%zu samples, %zu worker threads, %zu CPUs\n", aNumSamples, numThreads, nwork::GetCPUCount());
+
+		Mode modes[3];
+		modes[0].m_name = "epoll";
+		modes[1].m_name = "epoll-lifo";
+		modes[1].m_wakePolicy = nwork::Queue::WAKE_POLICY_LIFO;
+		modes[2].m_name = "busy-poll";
+		modes[2].m_spinBudget = std::chrono::seconds(1);
+
+		for(const Mode& mode : modes)
+			_MeasurePostToExecuteLatency(mode, numThreads, aNumSamples, std::chrono::microseconds(50));
+	}
+
+}
+
+int
+main(
+	int		aNumArgs,
+	char**	aArgs)
+{
+	size_t numSamples = aNumArgs > 1 ? (size_t)strtoul(aArgs[1], NULL, 10) : 20000;
+	if(numSamples == 0)
+		numSamples = 1;
+
+	nwork_bench::Run(numSamples);
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,3 @@
+#pragma once
+
+#include <nwork/Base.h>
\ No newline at end of file
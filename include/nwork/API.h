@@ -2,8 +2,20 @@
 
 #include "Base.h"
 
+#include "BlockingScope.h"
+#include "CancellationToken.h"
+#include "Fiber.h"
+#include "Future.h"
 #include "Group.h"
+#include "MailboxObject.h"
+#include "MPSCQueue.h"
+#include "NUMAThreadPool.h"
 #include "Object.h"
+#include "Pipeline.h"
 #include "Queue.h"
 #include "Reference.h"
-#include "ThreadPool.h"
\ No newline at end of file
+#include "Strand.h"
+#include "Task.h"
+#include "TaskGraph.h"
+#include "ThreadPool.h"
+#include "Topology.h"
\ No newline at end of file
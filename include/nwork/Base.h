@@ -3,17 +3,27 @@
 #if defined(WIN32)
 	#include <windows.h>
 #else
+	#include <sys/epoll.h>
 	#include <unistd.h>
 #endif
 
 #include <assert.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <chrono>
+#include <coroutine>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <semaphore>
+#include <span>
 #include <thread>
+#include <vector>
 
 namespace nwork
 {
@@ -66,22 +76,10 @@ namespace nwork
 			HANDLE	m_handle;
 		};
 
-		inline size_t 
-		GetCPUCount()
-		{
-			SYSTEM_INFO si;
-			GetSystemInfo(&si);
-			return (size_t)si.dwNumberOfProcessors;
-		}
-
-	#else
-	
-		inline size_t 
-		GetCPUCount()
-		{
-			return (size_t)sysconf(_SC_NPROCESSORS_ONLN);
-		}
-
 	#endif
 
+	// Number of CPUs the process can actually use, taking affinity mask and CPU quota into account. Defined in 
+	// Topology.cpp, detected once.
+	size_t	GetCPUCount();
+
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+namespace nwork
+{
+
+	class ThreadPool;
+
+	// Marks a blocking call (file IO, a lock held by something slow, ...) made by a task, so the thread pool can start 
+	// another thread to keep executing work in the meantime. Does nothing outside of thread pool threads.
+	class BlockingScope
+	{
+	public:
+						BlockingScope();
+						~BlockingScope();
+
+	private:
+
+		ThreadPool*		m_threadPool;
+	};
+
+}
\ No newline at end of file
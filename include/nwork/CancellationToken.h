@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Group.h"
+
+namespace nwork
+{
+
+	// Lets running tasks poll whether their group (or any of its ancestors) has been cancelled. Must not outlive the
+	// group.
+	class CancellationToken
+	{
+	public:
+		CancellationToken(
+			const Group*				aGroup = NULL)
+			: m_group(aGroup)
+		{
+
+		}
+
+		bool
+		IsCancelled() const
+		{
+			return m_group != NULL && m_group->IsCancelled();
+		}
+
+		explicit operator bool() const
+		{
+			return IsCancelled();
+		}
+
+	private:
+
+		const Group*					m_group;
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Queue.h"
+
+namespace nwork
+{
+
+	class FiberPool;
+	class Object;
+
+	// Objects posted with Queue::PostObjectAsFiber() execute on a pooled fiber stack. Waiting for groups or futures 
+	// on a fiber suspends it, allowing the worker thread to pick up other packets in the meantime.
+	class Fiber
+	{
+	public:
+		// Called on the worker thread after the fiber has been switched out, must arrange for Resume() to be called
+		typedef void (*SuspendCallback)(Fiber*, void*);
+
+		static Fiber*			GetCurrent();
+
+		void					Suspend(
+									SuspendCallback							aCallback,
+									void*									aContext);
+		void					Resume();
+		Queue::Packet			MakeResumePacket();
+		Queue*					GetWorkQueue();
+
+	private:
+
+		friend class FiberPool;
+
+		struct Context;
+
+		FiberPool*										m_pool = NULL;
+		Context*										m_context = NULL;
+		Object*											m_object = NULL;
+		bool											m_finished = false;
+		SuspendCallback									m_suspendCallback = NULL;
+		void*											m_suspendContext = NULL;
+		Fiber*											m_nextFree = NULL;
+
+		static void		_OnResume(
+							void*					aContext);
+		void			_Main();
+		void			_Run();
+		void			_SwitchOut();
+	};
+
+	class FiberPool
+	{
+	public:
+								FiberPool(
+									Queue*									aWorkQueue);
+								~FiberPool();
+
+		void					SetStackSize(
+									size_t									aStackSize);
+		void					Execute(
+									Object*									aObject);
+
+		// Data access
+		Queue*					GetWorkQueue() { return m_workQueue; }
+
+	private:
+
+		friend class Fiber;
+
+		Queue*											m_workQueue;
+		size_t											m_stackSize;
+
+		std::mutex										m_freeFibersLock;
+		Fiber*											m_freeFibers = NULL;
+		size_t											m_fiberCount = 0;
+
+		Fiber*			_CreateFiber();
+		void			_DestroyFiber(
+							Fiber*					aFiber);
+		Fiber*			_AcquireFiber();
+		void			_ReleaseFiber(
+							Fiber*					aFiber);
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,403 @@
+#pragma once
+
+#include "Fiber.h"
+#include "Object.h"
+#include "Queue.h"
+#include "Reference.h"
+
+namespace nwork
+{
+
+	class FutureStateBase
+		: public Object
+	{
+	public:
+		FutureStateBase(
+			Queue*											aWorkQueue)
+			: m_workQueue(aWorkQueue)
+			, m_refCount(0)
+			, m_ready(false)
+			, m_continuation(NULL)
+			, m_nextContinuation(NULL)
+			, m_waitingFiber(NULL)
+		{
+
+		}
+
+		virtual
+		~FutureStateBase()
+		{
+
+		}
+
+		void
+		AddReference()
+		{
+			m_refCount++;
+		}
+
+		void
+		RemoveReference()
+		{
+			if(--m_refCount == 0)
+				delete this;
+		}
+
+		void
+		Wait()
+		{
+			if(IsReady())
+				return;
+
+			Fiber* fiber = Fiber::GetCurrent();
+			if(fiber != NULL)
+			{
+				// Reference is released by _OnFiberSuspended()
+				AddReference();
+				fiber->Suspend(_OnFiberSuspended, this);
+				return;
+			}
+
+			m_ready.wait(false, std::memory_order_acquire);
+		}
+
+		void
+		AddContinuation(
+			FutureStateBase*								aContinuation)
+		{
+			aContinuation->AddReference();
+
+			FutureStateBase* head = m_continuation.load();
+
+			do
+			{
+				// Already completed
+				if(head == this)
+				{
+					_PostContinuation(aContinuation);
+					return;
+				}
+
+				aContinuation->m_nextContinuation = head;
+			}
+			while(!m_continuation.compare_exchange_weak(head, aContinuation));
+		}
+
+		// Object implementation
+		void
+		BeforePost() override
+		{
+			AddReference();
+		}
+
+		void
+		AfterExecute() override
+		{
+			RemoveReference();
+		}
+
+		// Data access
+		bool		IsReady() const { return m_ready.load(std::memory_order_acquire); }
+		Queue*		GetWorkQueue() { return m_workQueue; }
+
+	protected:
+
+		void
+		_OnReady()
+		{
+			m_ready.store(true);
+			m_ready.notify_all();
+
+			Fiber* waitingFiber = m_waitingFiber.exchange(NULL);
+			if(waitingFiber != NULL)
+				waitingFiber->Resume();
+
+			// Continuation list head is set to ourselves when completed
+			FutureStateBase* continuation = m_continuation.exchange(this);
+
+			// Most recently added first, post them in the order they were added
+			FutureStateBase* ordered = NULL;
+			while(continuation != NULL)
+			{
+				FutureStateBase* next = continuation->m_nextContinuation;
+				continuation->m_nextContinuation = ordered;
+				ordered = continuation;
+				continuation = next;
+			}
+
+			while(ordered != NULL)
+			{
+				FutureStateBase* next = ordered->m_nextContinuation;
+				_PostContinuation(ordered);
+				ordered = next;
+			}
+		}
+
+	private:
+
+		Queue*											m_workQueue;
+		std::atomic_uint32_t							m_refCount;
+		std::atomic_bool								m_ready;
+		std::atomic<FutureStateBase*>					m_continuation;
+		FutureStateBase*								m_nextContinuation;
+		std::atomic<Fiber*>								m_waitingFiber;
+
+		static void
+		_OnFiberSuspended(
+			Fiber*											aFiber,
+			void*											aContext)
+		{
+			FutureStateBase* state = (FutureStateBase*)aContext;
+			state->m_waitingFiber.store(aFiber);
+
+			// Resume it ourselves if it became ready in the meantime, unless _OnReady() beat us to it
+			if(state->m_ready.load() && state->m_waitingFiber.exchange(NULL) != NULL)
+				aFiber->Resume();
+
+			state->RemoveReference();
+		}
+
+		void
+		_PostContinuation(
+			FutureStateBase*								aContinuation)
+		{
+			m_workQueue->PostObject(aContinuation);
+			aContinuation->RemoveReference();
+		}
+	};
+
+	template <typename _T>
+	class FutureState
+		: public FutureStateBase
+	{
+	public:
+		FutureState(
+			Queue*											aWorkQueue)
+			: FutureStateBase(aWorkQueue)
+		{
+
+		}
+
+		virtual
+		~FutureState()
+		{
+
+		}
+
+		template <typename... _Args>
+		void
+		SetValue(
+			_Args&&...										aArgs)
+		{
+			assert(!IsReady());
+
+			if constexpr (!std::is_void_v<_T>)
+				m_value.emplace(std::forward<_Args>(aArgs)...);
+
+			_OnReady();
+		}
+
+		std::add_lvalue_reference_t<_T>
+		GetValue()
+		{
+			assert(IsReady());
+
+			if constexpr (!std::is_void_v<_T>)
+				return *m_value;
+		}
+
+	private:
+
+		struct Empty
+		{
+
+		};
+
+		std::optional<std::conditional_t<std::is_void_v<_T>, Empty, _T>>	m_value;
+	};
+
+	// Shared state of Queue::Async(), the function is stored inline so only a single allocation is needed per task
+	template <typename _T, typename _F>
+	class AsyncTask
+		: public FutureState<_T>
+	{
+	public:
+		template <typename _Function>
+		AsyncTask(
+			Queue*											aWorkQueue,
+			_Function&&										aFunction)
+			: FutureState<_T>(aWorkQueue)
+			, m_function(std::forward<_Function>(aFunction))
+		{
+
+		}
+
+		// Object implementation
+		void
+		ExecuteWork() override
+		{
+			if constexpr (std::is_void_v<_T>)
+			{
+				m_function();
+				this->SetValue();
+			}
+			else
+			{
+				this->SetValue(m_function());
+			}
+		}
+
+	private:
+
+		_F												m_function;
+	};
+
+	// Shared state of Future::Then(), posted to the work queue when the previous future completes
+	template <typename _T, typename _P, typename _F>
+	class ContinuationTask
+		: public FutureState<_T>
+	{
+	public:
+		template <typename _Function>
+		ContinuationTask(
+			Queue*											aWorkQueue,
+			FutureState<_P>*								aPrevious,
+			_Function&&										aFunction)
+			: FutureState<_T>(aWorkQueue)
+			, m_previous(aPrevious)
+			, m_function(std::forward<_Function>(aFunction))
+		{
+
+		}
+
+		// Object implementation
+		void
+		ExecuteWork() override
+		{
+			if constexpr (std::is_void_v<_T>)
+			{
+				_Invoke();
+				this->SetValue();
+			}
+			else
+			{
+				this->SetValue(_Invoke());
+			}
+
+			m_previous.Release();
+		}
+
+	private:
+
+		Reference<FutureState<_P>>						m_previous;
+		_F												m_function;
+
+		_T
+		_Invoke()
+		{
+			if constexpr (std::is_void_v<_P>)
+				return m_function();
+			else
+				return m_function(m_previous->GetValue());
+		}
+	};
+
+	template <typename _T>
+	class Future
+	{
+	public:
+		Future(
+			FutureState<_T>*								aState = NULL)
+			: m_state(aState)
+		{
+
+		}
+
+		void
+		Wait()
+		{
+			m_state->Wait();
+		}
+
+		std::add_lvalue_reference_t<_T>
+		Get()
+		{
+			m_state->Wait();
+			return m_state->GetValue();
+		}
+
+		// Continuation function is called with the value of this future and is posted to the work queue on completion. 
+		// A future can have any number of continuations, each gets the same value.
+		template <typename _F>
+		auto
+		Then(
+			_F&&											aFunction)
+		{
+			typedef std::decay_t<_F> FunctionType;
+			typedef typename std::conditional_t<std::is_void_v<_T>, std::invoke_result<FunctionType&>, std::invoke_result<FunctionType&, std::add_lvalue_reference_t<_T>>>::type ResultType;
+
+			ContinuationTask<ResultType, _T, FunctionType>* continuation = new ContinuationTask<ResultType, _T, FunctionType>(
+				m_state->GetWorkQueue(), m_state.GetPointer(), std::forward<_F>(aFunction));
+
+			Future<ResultType> future(continuation);
+			m_state->AddContinuation(continuation);
+			return future;
+		}
+
+		// Data access
+		bool		IsValid() const { return m_state.IsSet(); }
+		bool		IsReady() const { return m_state->IsReady(); }
+
+	private:
+
+		Reference<FutureState<_T>>						m_state;
+	};
+
+	template <typename _T>
+	class Promise
+	{
+	public:
+		Promise(
+			Queue*											aWorkQueue)
+			: m_state(new FutureState<_T>(aWorkQueue))
+		{
+
+		}
+
+		template <typename... _Args>
+		void
+		SetValue(
+			_Args&&...										aArgs)
+		{
+			m_state->SetValue(std::forward<_Args>(aArgs)...);
+		}
+
+		Future<_T>
+		GetFuture()
+		{
+			return Future<_T>(m_state.GetPointer());
+		}
+
+	private:
+
+		Reference<FutureState<_T>>						m_state;
+	};
+
+	//------------------------------------------------------------------------------------------------
+
+	template <typename _F>
+	Future<std::invoke_result_t<std::decay_t<_F>&>>
+	Queue::Async(
+		_F&&												aFunction)
+	{
+		typedef std::decay_t<_F> FunctionType;
+		typedef std::invoke_result_t<FunctionType&> ResultType;
+
+		AsyncTask<ResultType, FunctionType>* task = new AsyncTask<ResultType, FunctionType>(this, std::forward<_F>(aFunction));
+
+		Future<ResultType> future(task);
+		PostObject(task);
+		return future;
+	}
+
+}
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Queue.h"
+
 namespace nwork
 {
 
@@ -9,45 +11,108 @@ namespace nwork
 		enum Flag : uint32_t
 		{
 			FLAG_REFERENCE_COUNTED	= 0x00000001,
-			FLAG_FIXED_SIZE			= 0x00000002
+			FLAG_FIXED_SIZE			= 0x00000002,
+
+			// Spreads completions over per-thread counters, for groups with a very large number of tasks
+			FLAG_SHARDED			= 0x00000004,
+
+			// Set for groups created by NewPooled(), which are recycled instead of deleted
+			FLAG_POOLED				= 0x00000008
+		};
+
+		// Adding tasks to a group that isn't fixed size is allowed after OnAllPosted(), as long as it's done from a task 
+		// of the group (or anything else keeping it from completing).
+
+		// Coroutine or fiber to resume when the group completes, owned by the waiter until its packet is posted
+		struct Waiter
+		{
+			Queue*					m_workQueue = NULL;
+			Queue::Packet			m_packet;
+			Waiter*					m_next = NULL;
 		};
 
 		static Group*	NewReferenceCounted(
 							uint32_t				aFlags = 0,
 							uint32_t				aSize = 0);
+		static Group*	NewPooled(
+							uint32_t				aFlags = 0,
+							uint32_t				aSize = 0);
 
 						Group(
 							uint32_t				aFlags = 0,
 							uint32_t				aSize = 0);
 						~Group();
 
+		void			SetParent(
+							Group*					aParent);
 		void			OnCompletion();
-		void			OnPost();
+		void			Cancel();
+		bool			IsCancelled() const;
+		void			OnPost(
+							uint32_t				aCount = 1);
 		void			OnAllPosted();
 		void			Wait();
-		void			AddReference();
+		void			WaitAndHelp(
+							Queue*					aWorkQueue);
+		bool			WaitFor(
+							std::chrono::steady_clock::duration	aTimeout);
+		bool			TryWait();
+		void			AddReference(
+							uint32_t				aCount = 1);
 		void			RemoveReference();
 		void			SetCompletionFunction(
 							std::function<void()>	aFunction);
 
+		// Any number of waiters can be added. Returns false if there is nothing to wait for, in which case the packet 
+		// will never be posted.
+		bool			AddWaiter(
+							Waiter*					aWaiter);
+
 		// Data access
 		bool			IsReferenceCounted() const { return m_flags & FLAG_REFERENCE_COUNTED; }
 		bool			IsFixedSize() const { return m_flags & FLAG_FIXED_SIZE; }
+		bool			IsSharded() const { return m_flags & FLAG_SHARDED; }
+
+		// Sharded groups hold a single reference to themselves while tasks are pending, instead of one per task
+		bool			IsReferencedPerTask() const { return IsReferenceCounted() && !IsSharded(); }
 
 	private:
 
+		struct Shard;
+
+		static const uint64_t PENDING_SWEPT = 0x4000000000000000ULL;
+		static const uint64_t PENDING_COUNT_MASK = PENDING_SWEPT - 1;
+		static const uint64_t PENDING_NOT_ALL_POSTED = 0x0000010000000000ULL;
+
 		uint32_t				m_flags;
+		Group*					m_parent;
+		std::atomic_bool		m_cancelled;
 
-		uint32_t				m_posted;
-		std::atomic_uint32_t	m_size;
-		std::atomic_uint32_t	m_completed;
+		uint32_t				m_size;
+		std::atomic_uint32_t	m_posted;
+		std::atomic_bool		m_allPosted;
+		std::atomic_uint64_t	m_pending;
 		std::binary_semaphore	m_event;
 		std::function<void()>	m_completionFunction;
 
+		// Most recently added first
+		std::atomic<Waiter*>	m_waiters;
+
 		std::atomic_uint32_t	m_refCount;
+		bool					m_hasSelfReference;
+
+		std::unique_ptr<Shard[]>	m_shards;
+		uint32_t					m_shardCount;
 
+		bool			_PrepareWait();
+		void			_Subtract(
+							uint64_t				aCount);
+		uint64_t		_CloseShards();
 		void			_OnAllCompleted();
 		void			_OnUnreferenced();
+		void			_Reset(
+							uint32_t				aFlags,
+							uint32_t				aSize);
 	};
 
 }
\ No newline at end of file
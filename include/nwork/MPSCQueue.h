@@ -0,0 +1,86 @@
+#pragma once
+
+namespace nwork
+{
+
+	struct MPSCQueueNode
+	{
+		std::atomic<MPSCQueueNode*>		m_next = NULL;
+	};
+
+	// Intrusive, unbounded, lock-free queue for multiple producers and a single consumer. Items must derive from 
+	// MPSCQueueNode and can't be in more than one queue at a time.
+	template <typename _T>
+	class MPSCQueue
+	{
+	public:
+		MPSCQueue()
+			: m_head(&m_stub)
+			, m_tail(&m_stub)
+		{
+
+		}
+
+		void
+		Push(
+			_T*							aItem)
+		{
+			_Push(aItem);
+		}
+
+		// Can return NULL while a push is in progress, even if the queue isn't empty
+		_T*
+		Pop()
+		{
+			MPSCQueueNode* tail = m_tail;
+			MPSCQueueNode* next = tail->m_next.load(std::memory_order_acquire);
+
+			if(tail == &m_stub)
+			{
+				if(next == NULL)
+					return NULL;
+
+				m_tail = next;
+				tail = next;
+				next = next->m_next.load(std::memory_order_acquire);
+			}
+
+			if(next != NULL)
+			{
+				m_tail = next;
+				return static_cast<_T*>(tail);
+			}
+
+			if(tail != m_head.load(std::memory_order_acquire))
+				return NULL;
+
+			// Tail is the last item, put the stub back behind it so it can be removed
+			_Push(&m_stub);
+
+			next = tail->m_next.load(std::memory_order_acquire);
+			if(next != NULL)
+			{
+				m_tail = next;
+				return static_cast<_T*>(tail);
+			}
+
+			return NULL;
+		}
+
+	private:
+
+		std::atomic<MPSCQueueNode*>		m_head;
+		MPSCQueueNode*					m_tail;
+		MPSCQueueNode					m_stub;
+
+		void
+		_Push(
+			MPSCQueueNode*				aNode)
+		{
+			aNode->m_next.store(NULL, std::memory_order_relaxed);
+			MPSCQueueNode* previous = m_head.exchange(aNode, std::memory_order_acq_rel);
+			previous->m_next.store(aNode, std::memory_order_release);
+		}
+	};
+
+}
\ No newline at end of file
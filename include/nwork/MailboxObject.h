@@ -0,0 +1,55 @@
+#pragma once
+
+#include "MPSCQueue.h"
+#include "Object.h"
+
+namespace nwork
+{
+
+	class Queue;
+
+	// Object receiving messages, which are processed in the order they were sent, one at a time. It's posted to the 
+	// queue only while it has messages, so it's never executed concurrently.
+	class MailboxObject
+		: public Object
+	{
+	public:
+		struct Message
+			: public MPSCQueueNode
+		{
+			virtual			~Message() {}
+		};
+
+								MailboxObject(
+									Queue*									aWorkQueue,
+									size_t									aBatchSize = 32);
+		virtual					~MailboxObject();
+
+		// Takes ownership of the message, which is deleted after it has been processed
+		void					Send(
+									Message*								aMessage);
+		bool					IsCurrent() const;
+
+		// Virtual methods
+		virtual void			OnMessage(
+									Message*								aMessage) = 0;
+
+		// Object implementation
+		void					ExecuteWork() override;
+		void					AfterExecute() override;
+
+		// Data access
+		void					SetBatchSize(size_t aBatchSize) { assert(aBatchSize > 0); m_batchSize = aBatchSize; }
+		bool					IsIdle() const { return m_pending == 0; }
+		Queue*					GetWorkQueue() { return m_workQueue; }
+
+	private:
+
+		Queue*											m_workQueue;
+		size_t											m_batchSize;
+		MPSCQueue<Message>								m_messages;
+		std::atomic_size_t								m_pending;
+		size_t											m_processed;
+	};
+
+}
\ No newline at end of file
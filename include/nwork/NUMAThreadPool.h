@@ -0,0 +1,60 @@
+#pragma once
+
+namespace nwork
+{
+
+	class Group;
+	class Queue;
+	class ThreadPool;
+	class Topology;
+
+	// One queue and thread pool per NUMA node, with threads restricted to the CPUs of their node. Work is posted to 
+	// the node of the calling thread, so closures are allocated and executed on the same node. Idle threads take work 
+	// from other nodes.
+	class NUMAThreadPool
+	{
+	public:
+				NUMAThreadPool(
+					const Topology&					aTopology,
+					size_t							aThreadsPerNode = 0);
+				~NUMAThreadPool();
+
+		// Node of the calling thread, which is node 0 for threads outside of the pool that can't tell
+		size_t	GetLocalNodeIndex() const;
+		Queue*	GetLocalQueue();
+
+		void	PostFunction(
+					std::function<void()>			aFunction);
+		void	PostFunctionWithGroup(
+					Group*							aGroup,
+					std::function<void()>			aFunction);
+
+		// The range is split between nodes by thread count, the same way every time, so items first touched by a 
+		// node are processed by that node again in later passes. Work items are created by the nodes themselves.
+		void	ForEachInRange(
+					int32_t							aMin,
+					int32_t							aMax,
+					std::function<void(int32_t)>	aFunction);
+
+		// Data access
+		size_t	GetNodeCount() const { return m_nodes.size(); }
+		Queue*	GetQueue(size_t aNodeIndex) { return m_nodes[aNodeIndex]->m_queue.get(); }
+		size_t	GetThreadCount(size_t aNodeIndex) const { return m_nodes[aNodeIndex]->m_threadCount; }
+
+	private:
+
+		struct Node
+		{
+			uint32_t						m_nodeId = 0;
+			size_t							m_threadCount = 0;
+			std::unique_ptr<Queue>			m_queue;
+			std::unique_ptr<ThreadPool>		m_threadPool;
+		};
+
+		std::vector<std::unique_ptr<Node>>	m_nodes;
+
+		// Node index by CPU id
+		std::vector<size_t>					m_cpuNodeIndices;
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+namespace nwork
+{
+
+	class Queue;
+
+	class Pipeline
+	{
+	public:
+		enum StageMode : uint32_t
+		{
+			STAGE_MODE_PARALLEL,
+			STAGE_MODE_SERIAL_IN_ORDER,
+			STAGE_MODE_SERIAL_OUT_OF_ORDER
+		};
+
+		// Input function is called serially with a free token index and should return false when there is no more input
+		typedef std::function<bool(size_t)> InputFunction;
+		typedef std::function<void(size_t)> StageFunction;
+
+								Pipeline(
+									Queue*									aWorkQueue);
+								~Pipeline();
+
+		void					AddStage(
+									StageMode								aStageMode,
+									StageFunction							aStageFunction);
+		void					Run(
+									size_t									aMaxTokens,
+									InputFunction							aInputFunction);
+
+	private:
+
+		struct Stage;
+		struct Token;
+
+		Queue*											m_workQueue;
+		InputFunction									m_inputFunction;
+		std::vector<std::unique_ptr<Stage>>				m_stages;
+
+		size_t											m_maxTokens = 0;
+		size_t											m_activeTokens = 0;
+		bool											m_inputExhausted = false;
+		std::binary_semaphore*							m_completed = NULL;
+
+		void		_ExecuteStage(
+						Token*					aToken);
+		void		_AfterStage(
+						Token*					aToken);
+		void		_EnterStage(
+						size_t					aStageIndex,
+						Token*					aToken);
+		void		_LeaveStage(
+						Stage*					aStage);
+		void		_RetireToken(
+						Token*					aToken);
+		void		_PushToken(
+						Stage*					aStage,
+						Token*					aToken);
+		Token*		_PopToken(
+						Stage*					aStage);
+	};
+
+}
\ No newline at end of file
@@ -3,8 +3,14 @@
 namespace nwork
 {
 
+	class FdAwaiter;
+	class FiberPool;
 	class Group;
 	class Object;
+	class ScheduleAwaiter;
+
+	template <typename _T>
+	class Future;
 	
 	class Queue
 	{
@@ -13,7 +19,23 @@ namespace nwork
 		{
 			WAIT_RESULT_OK,
 			WAIT_RESULT_TIMED_OUT,
-			WAIT_RESULT_ERROR
+			WAIT_RESULT_ERROR,
+
+			// Got a stop packet. Only the outermost WaitAndExecute() of a thread gets them, nested calls (helping while 
+			// waiting for something) keep them for it.
+			WAIT_RESULT_STOPPED
+		};
+
+		static const uint32_t WAIT_INFINITE = UINT32_MAX;
+
+		enum WakePolicy : uint32_t
+		{
+			// Workers wait on the shared event and the kernel picks which one to wake up
+			WAKE_POLICY_ANY,
+
+			// Idle workers wait on their own event and the one that became idle last is woken up first, keeping the 
+			// set of busy threads small and their caches warm. IOCP always works like this.
+			WAKE_POLICY_LIFO
 		};
 
 		enum Type : uint32_t
@@ -35,6 +57,12 @@ namespace nwork
 			FUNCTION_FLAG_GROUP				= 0x80000000
 		};
 
+		enum ObjectFlag : uint32_t
+		{
+			OBJECT_FLAG_CALLBACK			= 0x40000000,
+			OBJECT_FLAG_FIBER				= 0x80000000
+		};
+
 		struct Packet
 		{
 			uint32_t		m_header = 0;
@@ -43,6 +71,16 @@ namespace nwork
 		};
 		
 		typedef std::function<void(uint32_t, void*)> IOFunction;
+		typedef void (*Callback)(void*);
+
+		#if !defined(WIN32)
+			// Armed on a registered file descriptor, packet is executed when the descriptor becomes ready
+			struct FdWaiter
+			{
+				Packet		m_packet;
+				uint32_t	m_events = 0;
+			};
+		#endif
 
 		static uint32_t
 		MakeHeader(
@@ -58,6 +96,20 @@ namespace nwork
 			return 0x0FFFFFFF | aType | aFlags;
 		}
 
+		static Packet
+		MakeCallbackPacket(
+			Callback														aCallback,
+			void*															aContext)
+		{
+			return { MakeHeader(TYPE_OBJECT, OBJECT_FLAG_CALLBACK), aContext, reinterpret_cast<void*>(aCallback) };
+		}
+
+		static Packet			MakeCoroutinePacket(
+									std::coroutine_handle<>					aHandle);
+
+		// Only accepted from the inbox of a worker, so it must be posted with PostPacketToWorker(). With IOCP there are 
+		// no inboxes and it's posted like any other packet.
+		static Packet			MakeStopPacket();
 
 								Queue();
 								~Queue();
@@ -66,22 +118,101 @@ namespace nwork
 									size_t									aForEachConcurrency);
 		void					SetIOFunction(
 									IOFunction								aIOFunction);
+
+		// Must be set before any object is posted as a fiber
+		void					SetFiberStackSize(
+									size_t									aFiberStackSize);
+
+		// Worker-local queues for affinity posting. Worker count can only grow and must be set before any worker is 
+		// attached. Idle threads steal from workers with more than the steal threshold number of packets queued. A 
+		// worker can only be attached to one thread at a time.
+		void					SetWorkerCount(
+									size_t									aWorkerCount);
+
+		// Must be set before any worker is created
+		void					SetWakePolicy(
+									WakePolicy								aWakePolicy);
+		WakePolicy				GetWakePolicy() const;
+
+		// Workers sleeping until they're woken up for shared packets, only with the LIFO policy. Always zero with IOCP.
+		size_t					GetParkedWorkerCount() const;
+
+		// Busy-poll mode for threads on dedicated cores. Threads about to sleep spin on the shared queue for up to this 
+		// long first, and posting only signals threads that are already asleep. Registered file descriptors aren't 
+		// checked while spinning. Not available with IOCP.
+		void					SetSpinBudget(
+									std::chrono::microseconds				aSpinBudget);
+		// Other threads take packets from the affinity queue of a worker when it has more than this number of them, or 
+		// when it has been busy with the same packet for a while
+		void					SetStealThreshold(
+									size_t									aStealThreshold);
+		void					AttachWorker(
+									size_t									aWorkerIndex);
+
+		// Anything left in the inbox or affinity queue of the worker is moved to the shared queue, and affinity packets 
+		// for it go there until a thread attaches again
+		void					DetachWorker();
+		size_t					GetWorkerCount() const;
+		bool					IsWorkerThread() const;
+
+		// Makes a waiting worker return from WaitAndExecute() with WAIT_RESULT_TIMED_OUT, so it can check its state 
+		// without being given anything to do
+		void					WakeWorker(
+									size_t									aWorkerIndex);
+
+		// Idle threads take work from the shared queues of these before going to sleep, for example the queues of 
+		// other NUMA nodes. Sleeping workers are woken up when a remote queue has more than its steal threshold number 
+		// of packets queued. Must be set before any thread waits on this queue or posts to the remote ones. Remote 
+		// packets are executed by this queue, so they shouldn't be IO or fiber packets.
+		void					SetRemoteQueues(
+									std::vector<Queue*>						aRemoteQueues);
+
+		// Packets waiting in the shared queue, and the total number ever posted to it, for load monitoring. Not 
+		// available with IOCP, where both are zero.
+		size_t					GetQueuedPacketCount() const;
+		uint64_t				GetPostedPacketCount() const;
+
+		// Packets waiting in the inbox and affinity queue of the calling worker, zero for other threads
+		size_t					GetLocalPacketCount() const;
+
 		void					PostPacket(
 									const Packet&							aPacket);
+		void					PostPackets(
+									const Packet*							aPackets,
+									size_t									aCount);
 		WaitResult				WaitAndExecute(
 									uint32_t								aMaxWaitTime);
 		void					ForEachInRange(
 									int32_t									aMin,
 									int32_t									aMax,
 									std::function<void(int32_t)>			aFunction);
+		void					PostPacketWithAffinity(
+									uint64_t								aKey,
+									const Packet&							aPacket);
+		void					PostPacketToWorker(
+									size_t									aWorkerIndex,
+									const Packet&							aPacket);
 		void					PostFunction(
 									std::function<void()>					aFunction);
+		void					PostWithAffinity(
+									uint64_t								aKey,
+									std::function<void()>					aFunction);
+		void					PostFunctionToWorker(
+									size_t									aWorkerIndex,
+									std::function<void()>					aFunction);
+		void					PostFunctionToWorkerWithGroup(
+									size_t									aWorkerIndex,
+									Group*									aGroup,
+									std::function<void()>					aFunction);
 		void					PostFunctionWithSemaphore(
 									std::counting_semaphore<>*				aSemaphore,
 									std::function<void()>					aFunction);
 		void					PostFunctionWithGroup(
 									Group*									aGroup,
 									std::function<void()>					aFunction);
+		void					PostFunctionsWithGroup(
+									Group*									aGroup,
+									std::span<std::function<void()>>		aFunctions);
 		void					PostFunctionPointer(
 									std::function<void()>*					aFunction);
 		void					PostFunctionPointerWithSemaphore(
@@ -89,6 +220,45 @@ namespace nwork
 									std::function<void()>*					aFunction);
 		void					PostObject(
 									Object*									aObject);
+		void					PostObjectAsFiber(
+									Object*									aObject);
+		void					PostCallback(
+									Callback								aCallback,
+									void*									aContext);
+		void					PostCoroutine(
+									std::coroutine_handle<>					aHandle);
+		ScheduleAwaiter			Schedule();
+
+		#if !defined(WIN32)
+			void				RegisterFd(
+									int										aFd);
+			void				UnregisterFd(
+									int										aFd);
+			void				ArmFd(
+									int										aFd,
+									uint32_t								aEvents,
+									FdWaiter*								aWaiter);
+			FdAwaiter			WaitForFd(
+									int										aFd,
+									uint32_t								aEvents);
+		#endif
+
+		// Defined in Future.h
+		template <typename _F>
+		Future<std::invoke_result_t<std::decay_t<_F>&>>
+		Async(
+			_F&&															aFunction);
+
+		// Posts all but the last function and executes that one on the calling thread, then helps executing queued 
+		// work until all of them have completed
+		template <typename... _Functions>
+		void
+		Invoke(
+			_Functions&&...													aFunctions)
+		{
+			std::function<void()> functions[] = { std::function<void()>(std::ref(aFunctions))... };
+			_Invoke(functions, sizeof...(aFunctions));
+		}
 
 		template <typename _T>
 		void
@@ -121,10 +291,14 @@ namespace nwork
 		}
 
 		// Data access
+		size_t	GetForEachConcurrency() const { return m_forEachConcurrency; }
+
 		#if defined(WIN32)
 			HANDLE	GetIOCPHandle() { return m_iocpHandle; }
 		#else
-			int		GetEpollFd() { return m_epollFd; }
+			// Epoll instance of registered file descriptors, see RegisterFd(). Threads don't wait on it directly 
+			// anymore, it's nested in the instances they wait on, so anything added to it must use FdWaiter data.
+			int		GetEpollFd() { return m_ioEpollFd; }
 		#endif
 
 	private:		
@@ -132,11 +306,16 @@ namespace nwork
 		size_t											m_forEachConcurrency = 1;
 		IOFunction										m_ioFunction;
 
+		// Created when the first fiber packet is executed, the stack size is the pool default when zero
+		std::atomic<FiberPool*>							m_fiberPool = NULL;
+		size_t											m_fiberStackSize = 0;
+
 		#if defined(WIN32)
 			Win32Handle									m_iocpHandle;
 		#else	
 			int											m_eventFd = 0;
 			int											m_epollFd = 0;
+			int											m_ioEpollFd = 0;
 
 			struct Internal;
 			Internal*									m_internal = NULL;
@@ -165,10 +344,17 @@ namespace nwork
 		WaitResult	_WaitForPacket(
 						uint32_t				aMaxWaitTime,
 						Packet&					aOut);
+		Packet		_MakeFunctionPacketWithGroup(
+						Group*					aGroup,
+						std::function<void()>	aFunction);
+		void		_Invoke(
+						std::function<void()>*	aFunctions,
+						size_t					aCount);
 		void		_ForEachVector(
 						ForEachVectorContext*	aContext,
 						void*					aVectorBase,
 						size_t					aVectorSize);
+		FiberPool*	_GetFiberPool();
 
 
 	};
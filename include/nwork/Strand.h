@@ -0,0 +1,32 @@
+#pragma once
+
+#include "MailboxObject.h"
+
+namespace nwork
+{
+
+	// Executes functions in the order they were posted, one at a time, on any thread calling WaitAndExecute() on the 
+	// queue. Only posted to the queue while it has functions to execute.
+	class Strand
+		: public MailboxObject
+	{
+	public:
+								Strand(
+									Queue*									aWorkQueue);
+		virtual					~Strand();
+
+		void					Post(
+									std::function<void()>					aFunction);
+		void					Dispatch(
+									std::function<void()>					aFunction);
+
+		// MailboxObject implementation
+		void					OnMessage(
+									Message*								aMessage) override;
+
+	private:
+
+		struct Task;
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,395 @@
+#pragma once
+
+#include "Group.h"
+#include "Queue.h"
+
+namespace nwork
+{
+
+	template <typename _T>
+	class Task;
+
+	class TaskPromiseBase
+	{
+	public:
+		struct FinalAwaiter
+		{
+			bool
+			await_ready() const noexcept
+			{
+				return false;
+			}
+
+			template <typename _Promise>
+			std::coroutine_handle<>
+			await_suspend(
+				std::coroutine_handle<_Promise>						aHandle) noexcept
+			{
+				TaskPromiseBase& promise = aHandle.promise();
+
+				if(promise.m_continuation)
+					return promise.m_continuation;
+
+				if(promise.m_detached)
+				{
+					aHandle.destroy();
+				}
+				else if(promise.m_event != NULL)
+				{
+					// Waiting thread will destroy the coroutine, so this must be the last thing touching it
+					std::binary_semaphore* event = promise.m_event;
+					event->release();
+				}
+
+				return std::noop_coroutine();
+			}
+
+			void
+			await_resume() const noexcept
+			{
+
+			}
+		};
+
+		std::suspend_always
+		initial_suspend() const noexcept
+		{
+			return {};
+		}
+
+		FinalAwaiter
+		final_suspend() const noexcept
+		{
+			return {};
+		}
+
+		void
+		unhandled_exception()
+		{
+			std::terminate();
+		}
+
+		// Public data
+		Queue*								m_workQueue = NULL;
+		std::coroutine_handle<>				m_continuation;
+		std::binary_semaphore*				m_event = NULL;
+		bool								m_detached = false;
+	};
+
+	template <typename _T>
+	class TaskPromise
+		: public TaskPromiseBase
+	{
+	public:
+		Task<_T>
+		get_return_object()
+		{
+			return Task<_T>(std::coroutine_handle<TaskPromise<_T>>::from_promise(*this));
+		}
+
+		template <typename _Value>
+		void
+		return_value(
+			_Value&&											aValue)
+		{
+			m_value.emplace(std::forward<_Value>(aValue));
+		}
+
+		_T
+		TakeValue()
+		{
+			assert(m_value.has_value());
+			return std::move(*m_value);
+		}
+
+	private:
+
+		std::optional<_T>						m_value;
+	};
+
+	template <>
+	class TaskPromise<void>
+		: public TaskPromiseBase
+	{
+	public:
+		Task<void>
+		get_return_object();
+
+		void
+		return_void()
+		{
+
+		}
+
+		void
+		TakeValue()
+		{
+
+		}
+	};
+
+	// Lazily started coroutine, awaiting it from another task starts it and resumes the awaiting task on completion
+	template <typename _T>
+	class Task
+	{
+	public:
+		typedef TaskPromise<_T> promise_type;
+
+		class Awaiter
+		{
+		public:
+			Awaiter(
+				std::coroutine_handle<promise_type>					aHandle)
+				: m_handle(aHandle)
+			{
+
+			}
+
+			bool
+			await_ready() const noexcept
+			{
+				return false;
+			}
+
+			template <typename _Promise>
+			std::coroutine_handle<>
+			await_suspend(
+				std::coroutine_handle<_Promise>						aHandle) noexcept
+			{
+				if constexpr (std::is_base_of_v<TaskPromiseBase, _Promise>)
+					m_handle.promise().m_workQueue = aHandle.promise().m_workQueue;
+
+				m_handle.promise().m_continuation = aHandle;
+				return m_handle;
+			}
+
+			_T
+			await_resume()
+			{
+				return m_handle.promise().TakeValue();
+			}
+
+		private:
+
+			std::coroutine_handle<promise_type>						m_handle;
+		};
+
+		Task(
+			std::coroutine_handle<promise_type>						aHandle = NULL)
+			: m_handle(aHandle)
+		{
+
+		}
+
+		Task(
+			Task<_T>&&												aMove)
+			: m_handle(aMove.m_handle)
+		{
+			aMove.m_handle = NULL;
+		}
+
+		~Task()
+		{
+			if(m_handle)
+				m_handle.destroy();
+		}
+
+		Task<_T>&
+		operator =(
+			Task<_T>&&												aMove)
+		{
+			if(m_handle)
+				m_handle.destroy();
+
+			m_handle = aMove.m_handle;
+			aMove.m_handle = NULL;
+			return *this;
+		}
+
+		Awaiter
+		operator co_await() const noexcept
+		{
+			return Awaiter(m_handle);
+		}
+
+		// Starts the task on the calling thread and blocks until it has completed
+		_T
+		Wait()
+		{
+			assert(m_handle);
+
+			std::binary_semaphore event(0);
+			m_handle.promise().m_event = &event;
+			m_handle.resume();
+			event.acquire();
+
+			return m_handle.promise().TakeValue();
+		}
+
+		// Starts the task on the calling thread, it will destroy itself when it has completed
+		void
+		Detach()
+		{
+			assert(m_handle);
+
+			std::coroutine_handle<promise_type> handle = m_handle;
+			m_handle = NULL;
+
+			handle.promise().m_detached = true;
+			handle.resume();
+		}
+
+		// Data access
+		bool		IsValid() const { return (bool)m_handle; }
+
+	private:
+
+		std::coroutine_handle<promise_type>							m_handle;
+	};
+
+	inline Task<void>
+	TaskPromise<void>::get_return_object()
+	{
+		return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+	}
+
+	// co_await queue.Schedule() resumes the task on the queue, which will also be used for resuming it after awaiting groups
+	class ScheduleAwaiter
+	{
+	public:
+		ScheduleAwaiter(
+			Queue*													aWorkQueue)
+			: m_workQueue(aWorkQueue)
+		{
+
+		}
+
+		bool
+		await_ready() const noexcept
+		{
+			return false;
+		}
+
+		template <typename _Promise>
+		void
+		await_suspend(
+			std::coroutine_handle<_Promise>							aHandle) noexcept
+		{
+			if constexpr (std::is_base_of_v<TaskPromiseBase, _Promise>)
+				aHandle.promise().m_workQueue = m_workQueue;
+
+			m_workQueue->PostCoroutine(aHandle);
+		}
+
+		void
+		await_resume() const noexcept
+		{
+
+		}
+
+	private:
+
+		Queue*														m_workQueue;
+	};
+
+	class GroupAwaiter
+	{
+	public:
+		GroupAwaiter(
+			Group*													aGroup)
+			: m_group(aGroup)
+		{
+
+		}
+
+		bool
+		await_ready() const noexcept
+		{
+			return false;
+		}
+
+		template <typename _Promise>
+		bool
+		await_suspend(
+			std::coroutine_handle<_Promise>							aHandle) noexcept
+		{
+			static_assert(std::is_base_of_v<TaskPromiseBase, _Promise>);
+
+			// Task must have been scheduled on a queue, which is where it will be resumed
+			Queue* workQueue = aHandle.promise().m_workQueue;
+			assert(workQueue != NULL);
+
+			m_waiter.m_workQueue = workQueue;
+			m_waiter.m_packet = Queue::MakeCoroutinePacket(aHandle);
+			return m_group->AddWaiter(&m_waiter);
+		}
+
+		void
+		await_resume() const noexcept
+		{
+
+		}
+
+	private:
+
+		Group*														m_group;
+
+		// Lives in the coroutine frame while it's suspended
+		Group::Waiter												m_waiter;
+	};
+
+	inline GroupAwaiter
+	operator co_await(
+		Group&														aGroup)
+	{
+		return GroupAwaiter(&aGroup);
+	}
+
+	#if !defined(WIN32)
+
+		// co_await queue.WaitForFd(...) resumes the task when a registered file descriptor becomes ready, returns the ready events
+		class FdAwaiter
+		{
+		public:
+			FdAwaiter(
+				Queue*												aWorkQueue,
+				int													aFd,
+				uint32_t											aEvents)
+				: m_workQueue(aWorkQueue)
+				, m_fd(aFd)
+				, m_events(aEvents)
+			{
+
+			}
+
+			bool
+			await_ready() const noexcept
+			{
+				return false;
+			}
+
+			void
+			await_suspend(
+				std::coroutine_handle<>								aHandle) noexcept
+			{
+				m_waiter.m_packet = Queue::MakeCoroutinePacket(aHandle);
+				m_workQueue->ArmFd(m_fd, m_events, &m_waiter);
+			}
+
+			uint32_t
+			await_resume() const noexcept
+			{
+				return m_waiter.m_events;
+			}
+
+		private:
+
+			Queue*													m_workQueue;
+			int														m_fd;
+			uint32_t												m_events;
+			Queue::FdWaiter											m_waiter;
+		};
+
+	#endif
+
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+
+namespace nwork
+{
+
+	class Group;
+	class Queue;
+
+	// Nodes are posted to the queue as soon as all the nodes they depend on have completed. A graph is built once and
+	// can then be posted repeatedly, which only resets counters and doesn't allocate anything.
+	//
+	// Graphs are recorded explicitly with the Add*Node() methods, mirroring Queue::PostFunctionWithGroup() (fan-out
+	// nodes), Queue::ForEachInRange() and Queue::ForEachVector(). Calls made directly on the queue are not captured, as
+	// those are posted immediately.
+	class TaskGraph
+	{
+	public:
+		typedef uint32_t NodeId;
+
+		struct NodeTiming
+		{
+			std::chrono::steady_clock::time_point		m_startTime;
+			std::chrono::steady_clock::time_point		m_endTime;
+			std::chrono::nanoseconds					m_executionTime = std::chrono::nanoseconds(0);
+		};
+
+								TaskGraph(
+									Queue*									aWorkQueue);
+								~TaskGraph();
+
+		NodeId					AddNode(
+									std::function<void()>					aFunction);
+		NodeId					AddFanOutNode(
+									std::vector<std::function<void()>>		aFunctions);
+		NodeId					AddForEachInRangeNode(
+									int32_t									aMin,
+									int32_t									aMax,
+									std::function<void(int32_t)>			aFunction);
+
+		// The vector must outlive the graph and keep its size, its items can be modified between posts
+		template <typename _T>
+		NodeId
+		AddForEachVectorNode(
+			std::vector<_T>&												aVector,
+			std::function<void(_T&)>										aFunction)
+		{
+			assert(!aVector.empty());
+
+			std::vector<_T>* vector = &aVector;
+			return AddForEachInRangeNode(0, (int32_t)aVector.size() - 1, [vector, function = std::move(aFunction)](int32_t aIndex)
+			{
+				function((*vector)[aIndex]);
+			});
+		}
+
+		template <typename _T>
+		NodeId
+		AddForEachVectorNode(
+			const std::vector<_T>&											aVector,
+			std::function<void(const _T&)>									aFunction)
+		{
+			assert(!aVector.empty());
+
+			const std::vector<_T>* vector = &aVector;
+			return AddForEachInRangeNode(0, (int32_t)aVector.size() - 1, [vector, function = std::move(aFunction)](int32_t aIndex)
+			{
+				function((*vector)[aIndex]);
+			});
+		}
+
+		void					AddDependency(
+									NodeId									aNodeId,
+									NodeId									aDependsOnNodeId);
+		void					Post(
+									Group*									aGroup);
+		void					Run();
+		NodeTiming				GetNodeTiming(
+									NodeId									aNodeId) const;
+
+		// Data access
+		size_t					GetNodeCount() const { return m_nodes.size(); }
+
+	private:
+
+		struct Node;
+		struct Part;
+
+		Queue*											m_workQueue;
+		std::vector<std::unique_ptr<Node>>				m_nodes;
+
+		NodeId			_AddNode(
+							std::vector<std::function<void()>>&	aFunctions);
+	};
+
+}
\ No newline at end of file
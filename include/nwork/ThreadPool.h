@@ -1,22 +1,146 @@
 #pragma once
 
+#include "Queue.h"
+
 namespace nwork
 {
 	
-	class Queue;
+	class Group;
 
 	class ThreadPool
 	{
 	public:
+		enum StopMode : uint32_t
+		{
+			// Threads stop after what they are currently executing
+			STOP_MODE_IMMEDIATE,
+
+			// Threads stop once there is nothing left for them to execute
+			STOP_MODE_DRAIN
+		};
+
+		enum Affinity : uint32_t
+		{
+			AFFINITY_NONE,
+
+			// All threads can run on any of the CPUs left after applying the options below
+			AFFINITY_CPU_SET,
+
+			// Each thread is pinned to the CPUs sharing an L3 cache, a physical core (all of its logical CPUs) or a single 
+			// logical CPU
+			AFFINITY_L3,
+			AFFINITY_CORE,
+			AFFINITY_CPU
+		};
+
+		struct Options
+		{
+			// Defaults to one thread per usable CPU (or core, if skipping SMT siblings), limited by the CPU quota
+			size_t					m_numThreads = 0;
+			Affinity				m_affinity = AFFINITY_NONE;
+
+			// Use only one logical CPU per physical core
+			bool					m_skipSMTSiblings = false;
+
+			// Leave the first cores of the process affinity mask for other threads, like the main thread
+			size_t					m_reservedCores = 0;
+
+			// Only use these CPUs, for example the ones of a NUMA node, instead of all the process can run on
+			std::vector<uint32_t>	m_cpus;
+
+			// Elastic mode, enabled when higher than the thread count. Extra threads are started, one per supervisor 
+			// interval, while the shared queue is longer than the length threshold or packets wait longer than the 
+			// age threshold. They stop after being idle for the idle timeout, but not within the idle timeout of the 
+			// pool last growing. Extra threads don't have worker-local queues. The supervisor wakes up once per 
+			// interval for as long as the pool runs, so short intervals cost CPU time even when the pool is idle.
+			size_t						m_maxThreads = 0;
+			size_t						m_growQueueLength = 64;
+			std::chrono::milliseconds	m_growQueueAge = std::chrono::milliseconds(5);
+			std::chrono::milliseconds	m_idleTimeout = std::chrono::milliseconds(1000);
+			std::chrono::milliseconds	m_supervisorInterval = std::chrono::milliseconds(50);
+
+			// Extra threads started to make up for threads blocked in a BlockingScope, on top of the elastic ones
+			size_t						m_maxBlockingThreads = 64;
+
+			// Applied to the queue, which can't have workers with another policy
+			Queue::WakePolicy			m_wakePolicy = Queue::WAKE_POLICY_ANY;
+
+			// Busy-poll mode when non-zero, applied to the queue. Best combined with pinned threads on dedicated cores.
+			std::chrono::microseconds	m_spinBudget = std::chrono::microseconds(0);
+		};
+
+		// Pool of the calling thread, NULL if it isn't a thread of a pool
+		static ThreadPool*	GetCurrent();
+
+		// Threads are attached to the workers of the queue starting from index 0, so a queue can only be used by one 
+		// pool at a time. Another one can be created once the previous one has stopped.
+		ThreadPool(
+			Queue*					aWorkQueue,
+			size_t					aNumThreads = 0);
 		ThreadPool(
-			Queue*				aWorkQueue,
-			size_t				aNumThreads = 0);
+			Queue*					aWorkQueue,
+			const Options&			aOptions);
 		~ThreadPool();
 
+		// Joins all threads, the destructor stops immediately if not stopped before. Idle threads sleep until there is 
+		// something to do or the pool is stopped.
+		void	Stop(
+					StopMode				aStopMode = STOP_MODE_IMMEDIATE);
+
+		// Executed by a specific thread of the pool, through its worker-local queue
+		void	PostToWorker(
+					size_t					aWorkerIndex,
+					std::function<void()>	aFunction);
+		void	PostToWorkerWithGroup(
+					size_t					aWorkerIndex,
+					Group*					aGroup,
+					std::function<void()>	aFunction);
+
+		// Executed once by every thread of the pool. Broadcast() returns when all of them are done.
+		void	Broadcast(
+					std::function<void()>	aFunction);
+		void	BroadcastWithGroup(
+					Group*					aGroup,
+					std::function<void()>	aFunction);
+
+		// Called by BlockingScope. There are always at least as many extra threads as there are blocked threads, 
+		// they stop after being idle once the blocking calls have returned.
+		void	BeginBlocking();
+		void	EndBlocking();
+
+		// Data access
+		size_t	GetThreadCount() const { return m_threads.size(); }
+		size_t	GetExtraThreadCount() const { return m_extraThreadCount; }
+		size_t	GetBlockedThreadCount() const { return m_blockedThreadCount; }
+
 	private:
 
+		struct ExtraThread;
+
+		Queue*										m_workQueue;
 		std::vector<std::unique_ptr<std::thread>>	m_threads;
 		std::atomic_bool							m_stop = false;
+		std::atomic_bool							m_drain = false;
+
+		Options										m_options;
+		std::vector<uint32_t>						m_extraThreadCPUs;
+		std::mutex									m_extraThreadsLock;
+		std::vector<std::unique_ptr<ExtraThread>>	m_extraThreads;
+		std::atomic_size_t							m_extraThreadCount = 0;
+		std::atomic_size_t							m_blockedThreadCount = 0;
+		std::atomic<std::chrono::steady_clock::time_point>	m_lastGrowTime;
+
+		std::unique_ptr<std::thread>				m_supervisor;
+		std::binary_semaphore						m_supervisorStop{ 0 };
+
+		void	_Start(
+					const Options&			aOptions);
+		void	_StartExtraThread();
+		void	_JoinStoppedExtraThreads();
+		void	_RunExtraThread(
+					ExtraThread*			aExtraThread);
+		void	_RunSupervisor();
+		void	_Drain();
 	};
 
 }
\ No newline at end of file
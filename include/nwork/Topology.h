@@ -0,0 +1,68 @@
+#pragma once
+
+namespace nwork
+{
+
+	// Logical CPUs the process is allowed to run on, and which physical cores, packages, NUMA nodes and L3 caches they 
+	// belong to. On Linux the CPU quota of the cgroup limits how many of them can be used at the same time.
+	class Topology
+	{
+	public:
+		struct CPU
+		{
+			uint32_t				m_id = 0;
+			uint32_t				m_coreId = 0;
+			uint32_t				m_packageId = 0;
+			uint32_t				m_nodeId = 0;
+
+			// Logical CPUs sharing the same last level cache have the same id
+			uint32_t				m_l3Id = 0;
+
+			bool					IsSameCore(const CPU& aOther) const { return m_coreId == aOther.m_coreId && m_packageId == aOther.m_packageId; }
+		};
+
+		// CPUs the process can run on. On Linux that's the affinity mask of the main thread, so it doesn't matter which 
+		// thread calls it.
+		static Topology				Detect();
+
+		// Made up topology with consecutive CPU ids, for testing NUMA code paths on a single node machine. Threads 
+		// shouldn't be pinned to its CPUs.
+		static Topology				Simulate(
+										uint32_t						aNodeCount,
+										uint32_t						aCoresPerNode,
+										uint32_t						aThreadsPerCore);
+		static bool					SetCurrentThreadAffinity(
+										const std::vector<uint32_t>&	aCPUIds);
+
+		// CPUs are sorted by package, core and id, so logical CPUs of the same core are next to each other
+		void						AddCPU(
+										const CPU&						aCPU);
+
+		std::vector<uint32_t>		GetNodeIds() const;
+		std::vector<uint32_t>		GetCPUIdsOfNode(
+										uint32_t						aNodeId) const;
+		std::vector<uint32_t>		GetL3Ids() const;
+		std::vector<uint32_t>		GetCPUIdsOfL3(
+										uint32_t						aL3Id) const;
+		size_t						GetPhysicalCoreCount() const;
+
+		// Logical CPUs limited by the CPU quota, rounded up, and at least one
+		size_t						GetUsableCPUCount() const;
+
+		// Data access
+		const std::vector<CPU>&		GetCPUs() const { return m_cpus; }
+		size_t						GetLogicalCPUCount() const { return m_cpus.size(); }
+		bool						IsSimulated() const { return m_simulated; }
+
+		// Number of CPUs worth of time the process can use, zero if unlimited
+		double						GetCPUQuota() const { return m_cpuQuota; }
+		void						SetCPUQuota(double aCPUQuota) { m_cpuQuota = aCPUQuota; }
+
+	private:
+
+		std::vector<CPU>			m_cpus;
+		bool						m_simulated = false;
+		double						m_cpuQuota = 0.0;
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "Pcheader.h"
+
+#include <nwork/BlockingScope.h>
+#include <nwork/ThreadPool.h>
+
+namespace nwork
+{
+
+	namespace
+	{
+
+		// Nested scopes only count once
+		thread_local uint32_t t_blockingScopeDepth = 0;
+
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	BlockingScope::BlockingScope()
+		: m_threadPool(t_blockingScopeDepth++ == 0 ? ThreadPool::GetCurrent() : NULL)
+	{
+		if(m_threadPool != NULL)
+			m_threadPool->BeginBlocking();
+	}
+
+	BlockingScope::~BlockingScope()
+	{
+		if(m_threadPool != NULL)
+			m_threadPool->EndBlocking();
+
+		assert(t_blockingScopeDepth > 0);
+		t_blockingScopeDepth--;
+	}
+
+}
\ No newline at end of file
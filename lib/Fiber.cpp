@@ -0,0 +1,322 @@
+#include "Pcheader.h"
+
+#include <nwork/Fiber.h>
+#include <nwork/Object.h>
+#include <nwork/Queue.h>
+
+namespace nwork
+{
+
+	namespace
+	{
+
+		thread_local Fiber*		t_currentFiber = NULL;
+
+		#if defined(WIN32)
+			thread_local LPVOID	t_workerFiber = NULL;
+		#endif
+
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	#if defined(WIN32)
+
+		struct Fiber::Context
+		{
+			static VOID CALLBACK
+			FiberMain(
+				LPVOID									aParameter)
+			{
+				Fiber* fiber = (Fiber*)aParameter;
+				fiber->_Main();
+			}
+
+			LPVOID										m_fiber = NULL;
+			LPVOID										m_workerFiber = NULL;
+		};
+
+	#else
+
+		struct Fiber::Context
+		{
+			static void
+			FiberMain()
+			{
+				// Started from Fiber::_Run(), so current fiber is the one we're running on
+				t_currentFiber->_Main();
+			}
+
+			ucontext_t									m_fiberContext;
+			ucontext_t*									m_workerContext = NULL;
+			void*										m_stack = NULL;
+			size_t										m_stackSize = 0;
+		};
+
+	#endif
+
+	//------------------------------------------------------------------------------------------------
+
+	Fiber*
+	Fiber::GetCurrent()
+	{
+		return t_currentFiber;
+	}
+
+	void
+	Fiber::Suspend(
+		SuspendCallback								aCallback,
+		void*										aContext)
+	{
+		assert(t_currentFiber == this);
+		assert(aCallback != NULL);
+
+		m_suspendCallback = aCallback;
+		m_suspendContext = aContext;
+
+		_SwitchOut();
+	}
+
+	void
+	Fiber::Resume()
+	{
+		m_pool->GetWorkQueue()->PostPacket(MakeResumePacket());
+	}
+
+	Queue::Packet
+	Fiber::MakeResumePacket()
+	{
+		return Queue::MakeCallbackPacket(_OnResume, this);
+	}
+
+	Queue*
+	Fiber::GetWorkQueue()
+	{
+		return m_pool->GetWorkQueue();
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	void
+	Fiber::_OnResume(
+		void*										aContext)
+	{
+		Fiber* fiber = (Fiber*)aContext;
+
+		if(t_currentFiber != NULL)
+		{
+			// We're helping with queued work from inside another fiber, leave it for a worker thread
+			fiber->Resume();
+			return;
+		}
+
+		fiber->_Run();
+	}
+
+	void
+	Fiber::_Main()
+	{
+		for(;;)
+		{
+			assert(m_object != NULL);
+			m_object->ExecuteWork();
+			m_object->AfterExecute();
+
+			m_object = NULL;
+			m_finished = true;
+
+			_SwitchOut();
+		}
+	}
+
+	void
+	Fiber::_Run()
+	{
+		assert(t_currentFiber == NULL);
+		t_currentFiber = this;
+
+		#if defined(WIN32)
+			if(t_workerFiber == NULL)
+				t_workerFiber = IsThreadAFiber() ? GetCurrentFiber() : ConvertThreadToFiber(NULL);
+
+			m_context->m_workerFiber = t_workerFiber;
+			SwitchToFiber(m_context->m_fiber);
+		#else
+			ucontext_t workerContext;
+			m_context->m_workerContext = &workerContext;
+
+			int result = swapcontext(&workerContext, &m_context->m_fiberContext);
+			(void)result;
+			assert(result == 0);
+		#endif
+
+		t_currentFiber = NULL;
+
+		if(m_finished)
+		{
+			m_pool->_ReleaseFiber(this);
+		}
+		else
+		{
+			// Fiber might be resumed on another thread as soon as the callback has been called
+			SuspendCallback suspendCallback = m_suspendCallback;
+			void* suspendContext = m_suspendContext;
+			m_suspendCallback = NULL;
+			m_suspendContext = NULL;
+			suspendCallback(this, suspendContext);
+		}
+	}
+
+	void
+	Fiber::_SwitchOut()
+	{
+		// Worker context is read from the fiber, as we might have been resumed on another thread
+		#if defined(WIN32)
+			SwitchToFiber(m_context->m_workerFiber);
+		#else
+			int result = swapcontext(&m_context->m_fiberContext, m_context->m_workerContext);
+			(void)result;
+			assert(result == 0);
+		#endif
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	FiberPool::FiberPool(
+		Queue*										aWorkQueue)
+		: m_workQueue(aWorkQueue)
+		, m_stackSize(64 * 1024)
+	{
+
+	}
+
+	FiberPool::~FiberPool()
+	{
+		size_t freeFiberCount = 0;
+
+		while(m_freeFibers != NULL)
+		{
+			Fiber* fiber = m_freeFibers;
+			m_freeFibers = fiber->m_nextFree;
+			_DestroyFiber(fiber);
+			freeFiberCount++;
+		}
+
+		// Suspended fibers would be left with a stack that's never unwound, so they must all have finished
+		assert(freeFiberCount == m_fiberCount);
+		(void)freeFiberCount;
+	}
+
+	void
+	FiberPool::SetStackSize(
+		size_t										aStackSize)
+	{
+		std::lock_guard lock(m_freeFibersLock);
+
+		// Can't be changed after fibers have been created
+		assert(m_fiberCount == 0);
+		m_stackSize = aStackSize;
+	}
+
+	void
+	FiberPool::Execute(
+		Object*										aObject)
+	{
+		if(t_currentFiber != NULL)
+		{
+			// Already on a fiber stack (helping with queued work while waiting)
+			aObject->ExecuteWork();
+			aObject->AfterExecute();
+			return;
+		}
+
+		Fiber* fiber = _AcquireFiber();
+		fiber->m_object = aObject;
+		fiber->m_finished = false;
+		fiber->_Run();
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	Fiber*
+	FiberPool::_CreateFiber()
+	{
+		Fiber* fiber = new Fiber();
+		fiber->m_pool = this;
+		fiber->m_context = new Fiber::Context();
+
+		#if defined(WIN32)
+			fiber->m_context->m_fiber = CreateFiber(m_stackSize, Fiber::Context::FiberMain, fiber);
+			assert(fiber->m_context->m_fiber != NULL);
+		#else
+			// Stack with a guard page at the bottom
+			size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+			size_t stackSize = ((m_stackSize + pageSize - 1) / pageSize) * pageSize;
+
+			void* stack = mmap(NULL, stackSize + pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+			assert(stack != MAP_FAILED);
+
+			int result = mprotect(stack, pageSize, PROT_NONE);
+			(void)result;
+			assert(result == 0);
+
+			fiber->m_context->m_stack = stack;
+			fiber->m_context->m_stackSize = stackSize + pageSize;
+
+			result = getcontext(&fiber->m_context->m_fiberContext);
+			assert(result == 0);
+
+			fiber->m_context->m_fiberContext.uc_stack.ss_sp = (uint8_t*)stack + pageSize;
+			fiber->m_context->m_fiberContext.uc_stack.ss_size = stackSize;
+			fiber->m_context->m_fiberContext.uc_link = NULL;
+			makecontext(&fiber->m_context->m_fiberContext, Fiber::Context::FiberMain, 0);
+		#endif
+
+		return fiber;
+	}
+
+	void
+	FiberPool::_DestroyFiber(
+		Fiber*										aFiber)
+	{
+		#if defined(WIN32)
+			DeleteFiber(aFiber->m_context->m_fiber);
+		#else
+			munmap(aFiber->m_context->m_stack, aFiber->m_context->m_stackSize);
+		#endif
+
+		delete aFiber->m_context;
+		delete aFiber;
+	}
+
+	Fiber*
+	FiberPool::_AcquireFiber()
+	{
+		{
+			std::lock_guard lock(m_freeFibersLock);
+
+			if(m_freeFibers != NULL)
+			{
+				Fiber* fiber = m_freeFibers;
+				m_freeFibers = fiber->m_nextFree;
+				fiber->m_nextFree = NULL;
+				return fiber;
+			}
+
+			m_fiberCount++;
+		}
+
+		return _CreateFiber();
+	}
+
+	void
+	FiberPool::_ReleaseFiber(
+		Fiber*										aFiber)
+	{
+		std::lock_guard lock(m_freeFibersLock);
+
+		aFiber->m_nextFree = m_freeFibers;
+		m_freeFibers = aFiber;
+	}
+
+}
\ No newline at end of file
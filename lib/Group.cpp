@@ -1,10 +1,54 @@
 #include "Pcheader.h"
 
+#include <nwork/Fiber.h>
 #include <nwork/Group.h>
 
 namespace nwork
 {
 
+	namespace
+	{
+
+		// Completions are flushed from a shard to the global pending counter in batches of this size
+		const uint64_t SHARD_BATCH_SIZE = 32;
+		const uint64_t SHARD_CLOSED = 0x8000000000000000ULL;
+		const uint32_t MAX_SHARDS = 64;
+
+		std::atomic_uint32_t g_nextShardThreadIndex = 0;
+		thread_local uint32_t t_shardThreadIndex = g_nextShardThreadIndex++;
+
+		// When a thread has more than this number of free pooled groups, half of them are moved to the shared pool
+		const size_t MAX_LOCAL_POOLED_GROUPS = 64;
+		const size_t MAX_SHARED_POOLED_GROUPS = 4096;
+
+		struct GroupPool
+		{
+			~GroupPool()
+			{
+				for(Group* group : m_groups)
+					delete group;
+			}
+
+			// Public data
+			std::vector<Group*>		m_groups;
+		};
+
+		// Waiter list of completed groups
+		Group::Waiter g_completedWaiters;
+
+		std::mutex g_sharedGroupPoolLock;
+		GroupPool g_sharedGroupPool;
+		thread_local GroupPool t_localGroupPool;
+
+	}
+
+	struct alignas(64) Group::Shard
+	{
+		std::atomic_uint64_t	m_count = 0;
+	};
+
+	//-------------------------------------------------------------------------------------------
+
 	Group* 
 	Group::NewReferenceCounted(
 		uint32_t	aFlags,
@@ -13,19 +57,40 @@ namespace nwork
 		return new Group(aFlags | FLAG_REFERENCE_COUNTED, aSize);
 	}
 
+	Group*
+	Group::NewPooled(
+		uint32_t	aFlags,
+		uint32_t	aSize)
+	{
+		std::vector<Group*>& localGroups = t_localGroupPool.m_groups;
+
+		if(localGroups.empty())
+		{
+			std::lock_guard lock(g_sharedGroupPoolLock);
+			std::vector<Group*>& sharedGroups = g_sharedGroupPool.m_groups;
+			size_t count = std::min(sharedGroups.size(), MAX_LOCAL_POOLED_GROUPS / 2);
+			localGroups.insert(localGroups.end(), sharedGroups.end() - count, sharedGroups.end());
+			sharedGroups.resize(sharedGroups.size() - count);
+		}
+
+		if(localGroups.empty())
+			return new Group(aFlags | FLAG_REFERENCE_COUNTED | FLAG_POOLED, aSize);
+
+		Group* group = localGroups.back();
+		localGroups.pop_back();
+		group->_Reset(aFlags | FLAG_REFERENCE_COUNTED | FLAG_POOLED, aSize);
+		return group;
+	}
+
 	//-------------------------------------------------------------------------------------------
 
 	Group::Group(
 		uint32_t	aFlags,
 		uint32_t	aSize)
-		: m_flags(aFlags)
-		, m_size(aSize)
-		, m_completed(0)
-		, m_refCount(0)
-		, m_posted(0)
-		, m_event(0)
+		: m_event(0)
+		, m_shardCount(0)
 	{
-		
+		_Reset(aFlags, aSize);
 	}
 	
 	Group::~Group()
@@ -33,57 +98,170 @@ namespace nwork
 
 	}
 
+	void
+	Group::SetParent(
+		Group*		aParent)
+	{
+		// Child counts as a single task of the parent until it completes
+		assert(m_parent == NULL);
+		assert(m_posted == 0);
+
+		if(aParent->IsReferencedPerTask())
+			aParent->AddReference();
+
+		aParent->OnPost();
+
+		m_parent = aParent;
+	}
+
 	void	
 	Group::OnCompletion()
 	{
-		m_completed++;
+		if(m_shards)
+		{
+			Shard& shard = m_shards[t_shardThreadIndex % m_shardCount];
+			uint64_t count = shard.m_count.fetch_add(1) + 1;
+
+			if(count & SHARD_CLOSED)
+				_Subtract(1);
+			else if(count % SHARD_BATCH_SIZE == 0)
+				_Subtract(SHARD_BATCH_SIZE);
+
+			return;
+		}
 
-		if(m_size == m_completed)
+		if(((m_pending.fetch_sub(1) - 1) & PENDING_COUNT_MASK) == 0)
 			_OnAllCompleted();
 	}
 
 	void
-	Group::OnPost()
+	Group::Cancel()
 	{
+		// Tasks that haven't started yet will be skipped, but still completed
+		m_cancelled = true;
+	}
+
+	bool
+	Group::IsCancelled() const
+	{
+		for(const Group* group = this; group != NULL; group = group->m_parent)
+		{
+			if(group->m_cancelled.load(std::memory_order_relaxed))
+				return true;
+		}
+
+		return false;
+	}
+
+	void
+	Group::OnPost(
+		uint32_t	aCount)
+	{
+		if(IsReferenceCounted() && IsSharded() && !m_hasSelfReference)
+		{
+			AddReference();
+			m_hasSelfReference = true;
+		}
+
 		if(!IsFixedSize())
 		{
-			assert(m_size == 0);
-			m_posted++;
+			m_pending += aCount;
+			m_posted += aCount;
 		}
 	}
 
 	void	
 	Group::OnAllPosted()
 	{
-		assert(m_size == 0);
+		assert(!IsFixedSize());
+		assert(!m_allPosted);
 
-		m_size = m_posted;
+		m_allPosted = true;
 
-		if(m_size == m_completed)
-			_OnAllCompleted();
+		_Subtract(PENDING_NOT_ALL_POSTED);
 	}
 
 	void	
 	Group::Wait()
 	{
-		if(IsFixedSize() && m_size == 0)
+		if(!_PrepareWait())
 			return;
 
-		if(!IsFixedSize() && m_posted == 0)
-			return;
+		Fiber* fiber = Fiber::GetCurrent();
+		if(fiber != NULL)
+		{
+			// Stack of the fiber stays around while it's suspended
+			struct SuspendContext
+			{
+				Group*	m_group;
+				Waiter	m_waiter;
+			};
 
-		if(m_posted > 0 && m_size == 0)
-			OnAllPosted();
+			SuspendContext context;
+			context.m_group = this;
+
+			fiber->Suspend([](
+				Fiber*	aFiber,
+				void*	aContext)
+			{
+				SuspendContext* context = (SuspendContext*)aContext;
+				context->m_waiter.m_workQueue = aFiber->GetWorkQueue();
+				context->m_waiter.m_packet = aFiber->MakeResumePacket();
+
+				if(!context->m_group->AddWaiter(&context->m_waiter))
+					aFiber->Resume();
+			}, &context);
+			return;
+		}
 
 		m_event.acquire();
 	}
 
 	void
-	Group::AddReference()
+	Group::WaitAndHelp(
+		Queue*					aWorkQueue)
+	{
+		if(Fiber::GetCurrent() != NULL)
+		{
+			// Suspend the fiber instead of helping
+			Wait();
+			return;
+		}
+
+		while(!TryWait())
+		{
+			// If there is nothing to help with, wait a little while for the group before checking for new work
+			if(aWorkQueue->WaitAndExecute(0) != Queue::WAIT_RESULT_OK && WaitFor(std::chrono::milliseconds(1)))
+				break;
+		}
+	}
+
+	bool
+	Group::WaitFor(
+		std::chrono::steady_clock::duration	aTimeout)
+	{
+		if(!_PrepareWait())
+			return true;
+
+		return m_event.try_acquire_for(aTimeout);
+	}
+
+	bool
+	Group::TryWait()
+	{
+		if(!_PrepareWait())
+			return true;
+
+		return m_event.try_acquire();
+	}
+
+	void
+	Group::AddReference(
+		uint32_t	aCount)
 	{
 		assert(IsReferenceCounted());
 
-		m_refCount++;
+		m_refCount += aCount;
 	}
 
 	void
@@ -102,15 +280,132 @@ namespace nwork
 		m_completionFunction = aFunction;
 	}
 
+	bool
+	Group::AddWaiter(
+		Waiter*					aWaiter)
+	{
+		if(!_PrepareWait())
+			return false;
+
+		Waiter* head = m_waiters.load();
+
+		do
+		{
+			if(head == &g_completedWaiters)
+				return false;
+
+			aWaiter->m_next = head;
+		}
+		while(!m_waiters.compare_exchange_weak(head, aWaiter));
+
+		return true;
+	}
+
 	//-------------------------------------------------------------------------------------------
 
+	bool
+	Group::_PrepareWait()
+	{
+		if(IsFixedSize())
+			return m_size > 0;
+
+		if(m_posted == 0)
+			return false;
+
+		if(!m_allPosted)
+			OnAllPosted();
+
+		return true;
+	}
+
+	void
+	Group::_Subtract(
+		uint64_t	aCount)
+	{
+		uint64_t pending = m_pending.load();
+		uint64_t newPending;
+		bool sweep;
+
+		do
+		{
+			newPending = pending - aCount;
+
+			// Once the count is low enough that everything left could be sitting in shards, close them and flush what 
+			// they have. Hold an extra count while doing it, so nobody else can complete the group in the meantime.
+			sweep = m_shards && !(pending & PENDING_SWEPT) && (newPending & PENDING_COUNT_MASK) > 0 
+				&& (newPending & PENDING_COUNT_MASK) <= SHARD_BATCH_SIZE * m_shardCount;
+
+			if(sweep)
+				newPending = (newPending + 1) | PENDING_SWEPT;
+		}
+		while(!m_pending.compare_exchange_weak(pending, newPending));
+
+		if(sweep)
+		{
+			uint64_t count = _CloseShards() + 1;
+			newPending = m_pending.fetch_sub(count) - count;
+		}
+
+		if((newPending & PENDING_COUNT_MASK) == 0)
+			_OnAllCompleted();
+	}
+
+	uint64_t
+	Group::_CloseShards()
+	{
+		// Returns the number of completions that haven't been flushed yet. Any later completions on a closed shard go 
+		// straight to the global counter.
+		uint64_t count = 0;
+
+		for(uint32_t i = 0; i < m_shardCount; i++)
+			count += m_shards[i].m_count.exchange(SHARD_CLOSED) % SHARD_BATCH_SIZE;
+
+		return count;
+	}
+
 	void
 	Group::_OnAllCompleted()
 	{
+		bool hasSelfReference = m_hasSelfReference;
+		Group* parent = m_parent;
+
 		if(m_completionFunction)
 			m_completionFunction();
 
+		Waiter* waiter = m_waiters.exchange(&g_completedWaiters);
+
 		m_event.release();
+
+		// Resumed in the order they started waiting. Each one might destroy the group, and its waiter, as soon as its 
+		// packet has been posted.
+		Waiter* ordered = NULL;
+		while(waiter != NULL)
+		{
+			Waiter* next = waiter->m_next;
+			waiter->m_next = ordered;
+			ordered = waiter;
+			waiter = next;
+		}
+
+		while(ordered != NULL)
+		{
+			Waiter* next = ordered->m_next;
+			ordered->m_workQueue->PostPacket(ordered->m_packet);
+			ordered = next;
+		}
+
+		// Self reference kept the group alive until now
+		if(hasSelfReference)
+			RemoveReference();
+
+		if(parent != NULL)
+		{
+			bool isReferencedPerTask = parent->IsReferencedPerTask();
+			parent->OnCompletion();
+
+			if(isReferencedPerTask)
+				parent->RemoveReference();
+		}
 	}
 
 	void			
@@ -118,7 +413,85 @@ namespace nwork
 	{
 		assert(IsReferenceCounted());
 
-		delete this;
+		if(!(m_flags & FLAG_POOLED))
+		{
+			delete this;
+			return;
+		}
+
+		// Don't keep anything captured by the completion function alive while in the pool
+		m_completionFunction = nullptr;
+
+		std::vector<Group*>& localGroups = t_localGroupPool.m_groups;
+		localGroups.push_back(this);
+
+		if(localGroups.size() > MAX_LOCAL_POOLED_GROUPS)
+		{
+			size_t count = localGroups.size() / 2;
+
+			{
+				std::lock_guard lock(g_sharedGroupPoolLock);
+				std::vector<Group*>& sharedGroups = g_sharedGroupPool.m_groups;
+				while(count > 0 && sharedGroups.size() < MAX_SHARED_POOLED_GROUPS)
+				{
+					sharedGroups.push_back(localGroups.back());
+					localGroups.pop_back();
+					count--;
+				}
+			}
+
+			for(; count > 0; count--)
+			{
+				delete localGroups.back();
+				localGroups.pop_back();
+			}
+		}
+	}
+
+	void
+	Group::_Reset(
+		uint32_t	aFlags,
+		uint32_t	aSize)
+	{
+		m_flags = aFlags;
+		m_parent = NULL;
+		m_cancelled = false;
+		m_size = aSize;
+		m_posted = 0;
+		m_allPosted = false;
+		m_pending = IsFixedSize() ? aSize : PENDING_NOT_ALL_POSTED;
+		m_refCount = 0;
+		m_hasSelfReference = false;
+		m_completionFunction = nullptr;
+		m_waiters = NULL;
+
+		// Event is left signaled if nobody waited for the previous use
+		m_event.try_acquire();
+
+		if(IsSharded())
+		{
+			if(!m_shards)
+			{
+				m_shardCount = std::min<uint32_t>(std::max<uint32_t>(GetCPUCount(), 1), MAX_SHARDS);
+				m_shards = std::make_unique<Shard[]>(m_shardCount);
+			}
+			else
+			{
+				for(uint32_t i = 0; i < m_shardCount; i++)
+					m_shards[i].m_count = 0;
+			}
+
+			// Small fixed size groups go straight to the global counter
+			if(IsFixedSize() && aSize <= SHARD_BATCH_SIZE * m_shardCount)
+			{
+				_CloseShards();
+				m_pending |= PENDING_SWEPT;
+			}
+		}
+		else
+		{
+			m_shards.reset();
+		}
 	}
 
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "Pcheader.h"
+
+#include <nwork/MailboxObject.h>
+#include <nwork/Queue.h>
+
+namespace nwork
+{
+
+	namespace
+	{
+
+		thread_local const MailboxObject* t_currentMailboxObject = NULL;
+
+	}
+
+	MailboxObject::MailboxObject(
+		Queue*										aWorkQueue,
+		size_t										aBatchSize)
+		: m_workQueue(aWorkQueue)
+		, m_batchSize(aBatchSize)
+		, m_pending(0)
+		, m_processed(0)
+	{
+		assert(m_batchSize > 0);
+	}
+
+	MailboxObject::~MailboxObject()
+	{
+		assert(m_pending == 0);
+	}
+
+	void
+	MailboxObject::Send(
+		Message*									aMessage)
+	{
+		m_messages.Push(aMessage);
+
+		// Whoever makes it non-empty is responsible for getting it executed
+		if(m_pending++ == 0)
+			m_workQueue->PostObject(this);
+	}
+
+	bool
+	MailboxObject::IsCurrent() const
+	{
+		return t_currentMailboxObject == this;
+	}
+
+	void
+	MailboxObject::ExecuteWork()
+	{
+		const MailboxObject* previousMailboxObject = t_currentMailboxObject;
+		t_currentMailboxObject = this;
+
+		size_t pending = std::min(m_pending.load(), m_batchSize);
+
+		for(m_processed = 0; m_processed < pending; m_processed++)
+		{
+			// Pending count is incremented after pushing, so the message must be there, but the push might not be 
+			// visible yet
+			Message* message = m_messages.Pop();
+			while(message == NULL)
+			{
+				std::this_thread::yield();
+				message = m_messages.Pop();
+			}
+
+			OnMessage(message);
+			delete message;
+		}
+
+		t_currentMailboxObject = previousMailboxObject;
+	}
+
+	void
+	MailboxObject::AfterExecute()
+	{
+		// Repost if more messages have been sent. Object might be destroyed or executed by another thread as soon as 
+		// the pending count has been updated.
+		size_t processed = m_processed;
+		Queue* workQueue = m_workQueue;
+
+		if(m_pending.fetch_sub(processed) != processed)
+			workQueue->PostObject(this);
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "Pcheader.h"
+
+#include <nwork/Group.h>
+#include <nwork/NUMAThreadPool.h>
+#include <nwork/Queue.h>
+#include <nwork/ThreadPool.h>
+#include <nwork/Topology.h>
+
+namespace nwork
+{
+
+	NUMAThreadPool::NUMAThreadPool(
+		const Topology&					aTopology,
+		size_t							aThreadsPerNode)
+	{
+		std::vector<uint32_t> nodeIds = aTopology.GetNodeIds();
+
+		// Topology detection failed, single node using all CPUs
+		if(nodeIds.empty())
+			nodeIds.push_back(0);
+
+		std::vector<std::vector<uint32_t>> nodeCPUIds;
+
+		for(size_t i = 0; i < nodeIds.size(); i++)
+		{
+			std::vector<uint32_t> cpuIds = aTopology.GetCPUIdsOfNode(nodeIds[i]);
+
+			std::unique_ptr<Node> node = std::make_unique<Node>();
+			node->m_nodeId = nodeIds[i];
+			node->m_threadCount = aThreadsPerNode;
+			if(node->m_threadCount == 0)
+				node->m_threadCount = cpuIds.empty() ? GetCPUCount() : cpuIds.size();
+
+			node->m_queue = std::make_unique<Queue>();
+			node->m_queue->SetForEachConcurrency(node->m_threadCount * 2);
+
+			for(uint32_t cpuId : cpuIds)
+			{
+				if(cpuId >= m_cpuNodeIndices.size())
+					m_cpuNodeIndices.resize(cpuId + 1, 0);
+
+				m_cpuNodeIndices[cpuId] = i;
+			}
+
+			nodeCPUIds.push_back(std::move(cpuIds));
+			m_nodes.push_back(std::move(node));
+		}
+
+		// Start looking at the next node, so not all idle nodes go to the same one
+		for(size_t i = 0; i < m_nodes.size(); i++)
+		{
+			std::vector<Queue*> remoteQueues;
+			for(size_t j = 1; j < m_nodes.size(); j++)
+				remoteQueues.push_back(m_nodes[(i + j) % m_nodes.size()]->m_queue.get());
+
+			m_nodes[i]->m_queue->SetRemoteQueues(std::move(remoteQueues));
+		}
+
+		for(size_t i = 0; i < m_nodes.size(); i++)
+		{
+			ThreadPool::Options options;
+			options.m_numThreads = m_nodes[i]->m_threadCount;
+
+			// Simulated CPUs don't exist
+			if(!aTopology.IsSimulated() && !nodeCPUIds[i].empty())
+			{
+				options.m_affinity = ThreadPool::AFFINITY_CPU_SET;
+				options.m_cpus = nodeCPUIds[i];
+			}
+
+			m_nodes[i]->m_threadPool = std::make_unique<ThreadPool>(m_nodes[i]->m_queue.get(), options);
+		}
+	}
+
+	NUMAThreadPool::~NUMAThreadPool()
+	{
+		// Threads of a node can be executing work of any other node
+		for(std::unique_ptr<Node>& node : m_nodes)
+			node->m_threadPool.reset();
+	}
+
+	size_t
+	NUMAThreadPool::GetLocalNodeIndex() const
+	{
+		for(size_t i = 0; i < m_nodes.size(); i++)
+		{
+			if(m_nodes[i]->m_queue->IsWorkerThread())
+				return i;
+		}
+
+		#if defined(WIN32)
+			size_t cpuId = (size_t)GetCurrentProcessorNumber();
+		#else
+			int result = sched_getcpu();
+			if(result < 0)
+				return 0;
+
+			size_t cpuId = (size_t)result;
+		#endif
+
+		return cpuId < m_cpuNodeIndices.size() ? m_cpuNodeIndices[cpuId] : 0;
+	}
+
+	Queue*
+	NUMAThreadPool::GetLocalQueue()
+	{
+		return m_nodes[GetLocalNodeIndex()]->m_queue.get();
+	}
+
+	void
+	NUMAThreadPool::PostFunction(
+		std::function<void()>			aFunction)
+	{
+		GetLocalQueue()->PostFunction(std::move(aFunction));
+	}
+
+	void
+	NUMAThreadPool::PostFunctionWithGroup(
+		Group*							aGroup,
+		std::function<void()>			aFunction)
+	{
+		GetLocalQueue()->PostFunctionWithGroup(aGroup, std::move(aFunction));
+	}
+
+	void
+	NUMAThreadPool::ForEachInRange(
+		int32_t							aMin,
+		int32_t							aMax,
+		std::function<void(int32_t)>	aFunction)
+	{
+		assert(aMax >= aMin);
+
+		size_t threadCount = 0;
+		for(const std::unique_ptr<Node>& node : m_nodes)
+			threadCount += node->m_threadCount;
+
+		Group group;
+
+		int64_t count = (int64_t)aMax - (int64_t)aMin + 1;
+		int64_t nodeMin = aMin;
+		size_t threadsSoFar = 0;
+
+		for(const std::unique_ptr<Node>& node : m_nodes)
+		{
+			threadsSoFar += node->m_threadCount;
+
+			int64_t nodeMax = (int64_t)aMin + count * (int64_t)threadsSoFar / (int64_t)threadCount - 1;
+			if(nodeMax < nodeMin)
+				continue;
+
+			Queue* queue = node->m_queue.get();
+
+			queue->PostFunctionWithGroup(&group, [queue, nodeMin, nodeMax, &group, &aFunction]()
+			{
+				int64_t step = std::max<int64_t>((nodeMax - nodeMin + 1) / (int64_t)queue->GetForEachConcurrency(), 1);
+
+				for(int64_t workMin = nodeMin; workMin <= nodeMax; workMin += step)
+				{
+					int64_t workMax = std::min(workMin + step - 1, nodeMax);
+
+					queue->PostFunctionWithGroup(&group, [workMin, workMax, &aFunction]()
+					{
+						for(int64_t i = workMin; i <= workMax; i++)
+							aFunction((int32_t)i);
+					});
+				}
+			});
+
+			nodeMin = nodeMax + 1;
+		}
+
+		group.WaitAndHelp(GetLocalQueue());
+	}
+
+}
\ No newline at end of file
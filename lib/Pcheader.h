@@ -3,8 +3,13 @@
 #include <nwork/Base.h>
 
 #if !defined(WIN32)
+	#include <dirent.h>
+	#include <pthread.h>
+	#include <sched.h>
 	#include <sys/epoll.h>
 	#include <sys/eventfd.h>
+	#include <sys/mman.h>
+	#include <ucontext.h>
 
 	#include <concurrentqueue.h>
 #endif
@@ -0,0 +1,310 @@
+#include "Pcheader.h"
+
+#include <nwork/Object.h>
+#include <nwork/Pipeline.h>
+#include <nwork/Queue.h>
+
+namespace nwork
+{
+
+	struct Pipeline::Stage
+	{
+		StageMode									m_stageMode = STAGE_MODE_SERIAL_OUT_OF_ORDER;
+		StageFunction								m_stageFunction;
+
+		std::mutex									m_lock;
+		bool										m_busy = false;
+		uint64_t									m_nextSequence = 0;
+
+		// Serial stages keep waiting tokens in a ring with room for every token, indexed by sequence if in-order
+		std::vector<Token*>							m_pending;
+		size_t										m_pendingHead = 0;
+		size_t										m_pendingCount = 0;
+	};
+
+	struct Pipeline::Token
+		: public Object
+	{
+		// Object implementation
+		void
+		ExecuteWork() override
+		{
+			m_pipeline->_ExecuteStage(this);
+		}
+
+		void
+		AfterExecute() override
+		{
+			m_pipeline->_AfterStage(this);
+		}
+
+		// Public data
+		Pipeline*									m_pipeline = NULL;
+		size_t										m_index = 0;
+		size_t										m_stageIndex = 0;
+		uint64_t									m_sequence = 0;
+		bool										m_hasItem = false;
+	};
+
+	//------------------------------------------------------------------------------------------------
+
+	Pipeline::Pipeline(
+		Queue*										aWorkQueue)
+		: m_workQueue(aWorkQueue)
+	{
+		// First stage is the serial input stage, its pending tokens are the free ones
+		m_stages.push_back(std::make_unique<Stage>());
+	}
+
+	Pipeline::~Pipeline()
+	{
+
+	}
+
+	void
+	Pipeline::AddStage(
+		StageMode									aStageMode,
+		StageFunction								aStageFunction)
+	{
+		std::unique_ptr<Stage> stage = std::make_unique<Stage>();
+		stage->m_stageMode = aStageMode;
+		stage->m_stageFunction = std::move(aStageFunction);
+		m_stages.push_back(std::move(stage));
+	}
+
+	void
+	Pipeline::Run(
+		size_t										aMaxTokens,
+		InputFunction								aInputFunction)
+	{
+		assert(aMaxTokens > 0);
+
+		std::binary_semaphore completed(0);
+
+		m_inputFunction = std::move(aInputFunction);
+		m_maxTokens = aMaxTokens;
+		m_activeTokens = 0;
+		m_inputExhausted = false;
+		m_completed = &completed;
+
+		for(std::unique_ptr<Stage>& stage : m_stages)
+		{
+			stage->m_busy = false;
+			stage->m_nextSequence = 0;
+			stage->m_pending.assign(aMaxTokens, NULL);
+			stage->m_pendingHead = 0;
+			stage->m_pendingCount = 0;
+		}
+
+		std::vector<Token> tokens(aMaxTokens);
+
+		Stage* input = m_stages[0].get();
+		Token* first = NULL;
+
+		{
+			std::lock_guard lock(input->m_lock);
+
+			for(size_t i = 0; i < aMaxTokens; i++)
+			{
+				tokens[i].m_pipeline = this;
+				tokens[i].m_index = i;
+				_PushToken(input, &tokens[i]);
+			}
+
+			first = _PopToken(input);
+			input->m_busy = true;
+		}
+
+		m_workQueue->PostObject(first);
+
+		completed.acquire();
+
+		m_completed = NULL;
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	void
+	Pipeline::_ExecuteStage(
+		Token*										aToken)
+	{
+		if(aToken->m_stageIndex == 0)
+			aToken->m_hasItem = m_inputFunction(aToken->m_index);
+		else
+			m_stages[aToken->m_stageIndex]->m_stageFunction(aToken->m_index);
+	}
+
+	void
+	Pipeline::_AfterStage(
+		Token*										aToken)
+	{
+		// Retiring or passing on the token must be the last thing we do, as the pipeline might complete
+		size_t stageIndex = aToken->m_stageIndex;
+		Stage* stage = m_stages[stageIndex].get();
+
+		if(stageIndex == 0)
+		{
+			std::lock_guard lock(stage->m_lock);
+
+			if(aToken->m_hasItem)
+				aToken->m_sequence = stage->m_nextSequence++;
+			else
+				m_inputExhausted = true;
+		}
+
+		if(stage->m_stageMode != STAGE_MODE_PARALLEL)
+			_LeaveStage(stage);
+
+		if(!aToken->m_hasItem || stageIndex + 1 == m_stages.size())
+			_RetireToken(aToken);
+		else
+			_EnterStage(stageIndex + 1, aToken);
+	}
+
+	void
+	Pipeline::_EnterStage(
+		size_t										aStageIndex,
+		Token*										aToken)
+	{
+		Stage* stage = m_stages[aStageIndex].get();
+
+		aToken->m_stageIndex = aStageIndex;
+
+		if(stage->m_stageMode == STAGE_MODE_PARALLEL)
+		{
+			m_workQueue->PostObject(aToken);
+			return;
+		}
+
+		Token* next = NULL;
+
+		{
+			std::lock_guard lock(stage->m_lock);
+
+			_PushToken(stage, aToken);
+
+			if(!stage->m_busy)
+			{
+				next = _PopToken(stage);
+				stage->m_busy = next != NULL;
+			}
+		}
+
+		if(next != NULL)
+			m_workQueue->PostObject(next);
+	}
+
+	void
+	Pipeline::_LeaveStage(
+		Stage*										aStage)
+	{
+		Token* next = NULL;
+
+		{
+			std::lock_guard lock(aStage->m_lock);
+
+			if(aStage->m_stageMode == STAGE_MODE_SERIAL_IN_ORDER)
+				aStage->m_nextSequence++;
+
+			next = _PopToken(aStage);
+			aStage->m_busy = next != NULL;
+		}
+
+		if(next != NULL)
+			m_workQueue->PostObject(next);
+	}
+
+	void
+	Pipeline::_RetireToken(
+		Token*										aToken)
+	{
+		Stage* input = m_stages[0].get();
+		Token* next = NULL;
+		std::binary_semaphore* completed = NULL;
+
+		{
+			std::lock_guard lock(input->m_lock);
+
+			assert(m_activeTokens > 0);
+			m_activeTokens--;
+
+			if(m_inputExhausted)
+			{
+				if(m_activeTokens == 0)
+					completed = m_completed;
+			}
+			else
+			{
+				aToken->m_stageIndex = 0;
+				aToken->m_hasItem = false;
+				_PushToken(input, aToken);
+
+				if(!input->m_busy)
+				{
+					next = _PopToken(input);
+					input->m_busy = next != NULL;
+				}
+			}
+		}
+
+		if(next != NULL)
+			m_workQueue->PostObject(next);
+
+		if(completed != NULL)
+			completed->release();
+	}
+
+	void
+	Pipeline::_PushToken(
+		Stage*										aStage,
+		Token*										aToken)
+	{
+		if(aStage->m_stageMode == STAGE_MODE_SERIAL_IN_ORDER)
+		{
+			Token*& slot = aStage->m_pending[aToken->m_sequence % m_maxTokens];
+			assert(slot == NULL);
+			slot = aToken;
+		}
+		else
+		{
+			assert(aStage->m_pendingCount < m_maxTokens);
+			aStage->m_pending[(aStage->m_pendingHead + aStage->m_pendingCount) % m_maxTokens] = aToken;
+			aStage->m_pendingCount++;
+		}
+	}
+
+	Pipeline::Token*
+	Pipeline::_PopToken(
+		Stage*										aStage)
+	{
+		Token* token = NULL;
+
+		if(aStage->m_stageMode == STAGE_MODE_SERIAL_IN_ORDER)
+		{
+			Token*& slot = aStage->m_pending[aStage->m_nextSequence % m_maxTokens];
+			if(slot != NULL && slot->m_sequence == aStage->m_nextSequence)
+			{
+				token = slot;
+				slot = NULL;
+			}
+		}
+		else if(aStage->m_pendingCount > 0)
+		{
+			if(aStage == m_stages[0].get())
+			{
+				// Input stage: don't hand out free tokens once input has been exhausted
+				if(m_inputExhausted)
+					return NULL;
+
+				m_activeTokens++;
+			}
+
+			token = aStage->m_pending[aStage->m_pendingHead];
+			aStage->m_pendingHead = (aStage->m_pendingHead + 1) % m_maxTokens;
+			aStage->m_pendingCount--;
+		}
+
+		return token;
+	}
+
+}
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include "Pcheader.h"
 
+#include <nwork/Fiber.h>
 #include <nwork/Group.h>
 #include <nwork/Object.h>
 #include <nwork/Queue.h>
+#include <nwork/Task.h>
 
 namespace nwork
 {
@@ -32,6 +34,170 @@ namespace nwork
 			return static_cast<int32_t>(aInt32Range >> 32ULL);
 		}
 
+		void
+		_CPUPause()
+		{
+			#if defined(_MSC_VER)
+				YieldProcessor();
+			#elif defined(__x86_64__) || defined(__i386__)
+				__builtin_ia32_pause();
+			#elif defined(__aarch64__)
+				__asm__ __volatile__("yield");
+			#endif
+		}
+
+		void
+		_ResumeCoroutine(
+			void*															aAddress)
+		{
+			std::coroutine_handle<>::from_address(aAddress).resume();
+		}
+
+		#if !defined(WIN32)
+			const size_t MAX_WORKERS = 256;
+			const size_t DEFAULT_STEAL_THRESHOLD = 4;
+
+			// Affinity packets below the steal threshold are stolen when their worker has been busy for this long, it 
+			// might be blocked
+			const std::chrono::milliseconds STEAL_BUSY_TIME(1);
+
+			// Epoll data for events that aren't from registered file descriptors, the shared queue uses NULL
+			int g_workerEventTag;
+			int g_helpEventTag;
+			int g_ioEventTag;
+
+			struct Worker
+			{
+				~Worker()
+				{
+					if(m_epollFd >= 0)
+						close(m_epollFd);
+
+					if(m_eventFd >= 0)
+						close(m_eventFd);
+				}
+
+				// Public data
+				const Queue*								m_workQueue = NULL;
+				size_t										m_index = 0;
+				int											m_epollFd = -1;
+				int											m_eventFd = -1;
+				moodycamel::ConcurrentQueue<Queue::Packet>	m_affinityQueue;
+				std::atomic_size_t							m_affinityQueueLength = 0;
+
+				// Packets that must be executed by this worker, never stolen
+				moodycamel::ConcurrentQueue<Queue::Packet>	m_inbox;
+				std::atomic_size_t							m_inboxLength = 0;
+
+				// Waiting to be woken up for shared packets, protected by the parked workers lock
+				bool										m_parked = false;
+
+				// Set by WakeWorker(), so spinning workers notice it
+				std::atomic_bool							m_wakeRequested = false;
+
+				// Only one thread at a time can be a worker
+				std::atomic_bool							m_attached = false;
+
+				// Steady clock time when the packet being executed was taken, zero while waiting
+				std::atomic_int64_t							m_busySince = 0;
+
+				// Stop packet taken while helping, returned by the outermost loop. Only used by the attached thread.
+				bool										m_stopPending = false;
+			};
+
+			thread_local Worker* t_currentWorker = NULL;
+
+			int64_t
+			_GetBusyTime()
+			{
+				return (int64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+			}
+
+			bool
+			_FindEvent(
+				const struct epoll_event*									aEvents,
+				int															aCount,
+				struct epoll_event&											aOut,
+				bool*														aOutShared)
+			{
+				bool found = false;
+
+				for(int i = 0; i < aCount; i++)
+				{
+					if(aEvents[i].data.ptr == NULL)
+					{
+						if(aOutShared != NULL)
+							*aOutShared = true;
+					}
+					else if(!found)
+					{
+						aOut = aEvents[i];
+						found = true;
+					}
+				}
+
+				return found;
+			}
+
+			size_t
+			_GetAffinityWorkerIndex(
+				uint64_t													aKey,
+				size_t														aWorkerCount)
+			{
+				// Keys are often aligned pointers or strided ids, so mix all bits in before reducing (splitmix64 finalizer)
+				aKey ^= aKey >> 30;
+				aKey *= 0xBF58476D1CE4E5B9ULL;
+				aKey ^= aKey >> 27;
+				aKey *= 0x94D049BB133111EBULL;
+				aKey ^= aKey >> 31;
+
+				return (size_t)(aKey % (uint64_t)aWorkerCount);
+			}
+		#endif
+
+		// Number of packets being executed by the calling thread, more than one when helping
+		thread_local uint32_t t_executeDepth = 0;
+
+		// Object pointer of stop packets, which can't be mistaken for a posted object
+		int g_stopPacketTag;
+
+		bool
+		_IsStopPacket(
+			const Queue::Packet&											aPacket)
+		{
+			return aPacket.m_header == Queue::MakeHeader(Queue::TYPE_OBJECT, 0) && aPacket.m_pointer1 == &g_stopPacketTag;
+		}
+
+		#if !defined(WIN32)
+
+			void
+			_AddToEpoll(
+				int															aEpollFd,
+				int															aFd,
+				uint32_t													aEvents,
+				void*														aData)
+			{
+				struct epoll_event t;
+				memset(&t, 0, sizeof(epoll_event));
+				t.events = aEvents;
+				t.data.ptr = aData;
+
+				int result = epoll_ctl(aEpollFd, EPOLL_CTL_ADD, aFd, &t);
+				(void)result;
+				assert(result == 0);
+			}
+
+			void
+			_SignalEventFd(
+				int															aEventFd,
+				uint64_t													aCount)
+			{
+				ssize_t bytes = write(aEventFd, &aCount, sizeof(aCount));
+				(void)bytes;
+				assert(bytes == sizeof(aCount));
+			}
+		#endif
+
 	}
 
 	//------------------------------------------------------------------------------------------------
@@ -39,8 +205,297 @@ namespace nwork
 	#if !defined(WIN32)
 		struct Queue::Internal
 		{
+			~Internal()
+			{
+				if(m_helpEventFd >= 0)
+					close(m_helpEventFd);
+			}
+
+			static bool
+			DequeuePacket(
+				moodycamel::ConcurrentQueue<Packet>&	aQueue,
+				std::atomic_size_t&					aQueueLength,
+				Packet&								aOut)
+			{
+				size_t length = aQueueLength;
+
+				do
+				{
+					if(length == 0)
+						return false;
+				}
+				while(!aQueueLength.compare_exchange_weak(length, length - 1));
+
+				// Length is incremented after enqueuing, so there is a packet for us
+				while(!aQueue.try_dequeue(aOut))
+					;
+
+				return true;
+			}
+
+			bool
+			StealPacket(
+				Worker*								aThief,
+				Packet&								aOut,
+				bool*								aOutBusyVictim = NULL)
+			{
+				size_t workerCount = m_workerCount;
+				size_t start = aThief != NULL ? aThief->m_index + 1 : 0;
+				int64_t now = 0;
+
+				for(size_t i = 0; i < workerCount; i++)
+				{
+					Worker* victim = m_workers[(start + i) % workerCount].get();
+					size_t length = victim->m_affinityQueueLength;
+
+					if(victim == aThief || length == 0)
+						continue;
+
+					if(length <= m_stealThreshold)
+					{
+						// Few enough for the worker itself, unless it's stuck in something
+						int64_t busySince = victim->m_busySince;
+						if(busySince == 0)
+							continue;
+
+						if(now == 0)
+							now = _GetBusyTime();
+
+						if(now - busySince < (int64_t)std::chrono::duration_cast<std::chrono::steady_clock::duration>(STEAL_BUSY_TIME).count())
+						{
+							// Caller should check again later
+							if(aOutBusyVictim != NULL)
+								*aOutBusyVictim = true;
+
+							continue;
+						}
+					}
+
+					if(DequeuePacket(victim->m_affinityQueue, victim->m_affinityQueueLength, aOut))
+						return true;
+				}
+
+				return false;
+			}
+
+			void
+			PostShared(
+				const Packet&						aPacket)
+			{
+				m_concurrentQueue.enqueue(aPacket);
+				size_t length = ++m_queueLength;
+
+				SignalShared(1);
+
+				if(length == m_stealThreshold + 1)
+					RequestHelp();
+			}
+
+			void
+			MoveLocalPackets(
+				Worker*								aWorker,
+				bool								aIncludeInbox)
+			{
+				// Nobody would execute them otherwise. Stop packets are for the thread that was attached.
+				Packet packet;
+
+				while(aIncludeInbox && DequeuePacket(aWorker->m_inbox, aWorker->m_inboxLength, packet))
+				{
+					if(!_IsStopPacket(packet))
+						PostShared(packet);
+				}
+
+				while(DequeuePacket(aWorker->m_affinityQueue, aWorker->m_affinityQueueLength, packet))
+					PostShared(packet);
+			}
+
+			void
+			DequeueSharedWithCredit(
+				Packet&								aOut)
+			{
+				// Credits are added after the packets, so there is one for us
+				bool ok = DequeuePacket(m_concurrentQueue, m_queueLength, aOut);
+				(void)ok;
+				assert(ok);
+			}
+
+			bool
+			TryDequeueShared(
+				Packet&								aOut)
+			{
+				int64_t credits = m_sharedCredits;
+
+				do
+				{
+					if(credits <= 0)
+						return false;
+				}
+				while(!m_sharedCredits.compare_exchange_weak(credits, credits - 1));
+
+				DequeueSharedWithCredit(aOut);
+				return true;
+			}
+
+			bool
+			BeginSharedWait()
+			{
+				// Either there is a packet to take, or we'll get a token from the shared event for the next one
+				return m_sharedCredits.fetch_sub(1) > 0;
+			}
+
+			bool
+			EndSharedWait(
+				bool								aSignaled)
+			{
+				uint64_t v = 0;
+				if(aSignaled && read(m_eventFd, &v, sizeof(v)) == sizeof(v))
+					return true;
+
+				int64_t credits = m_sharedCredits;
+
+				while(credits < 0)
+				{
+					if(m_sharedCredits.compare_exchange_weak(credits, credits + 1))
+						return false;
+				}
+
+				// A packet was posted for us after all, its token is on the way
+				while(read(m_eventFd, &v, sizeof(v)) != sizeof(v))
+					_CPUPause();
+
+				return true;
+			}
+
+			bool
+			SpinForPacket(
+				Worker*								aWorker,
+				Packet&								aOut)
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				bool found = false;
+
+				for(uint32_t i = 1; !found; i++)
+				{
+					found = TryDequeueShared(aOut);
+
+					// Anything for the worker itself is picked up through its event
+					if(aWorker != NULL && (aWorker->m_inboxLength > 0 || aWorker->m_affinityQueueLength > 0 || aWorker->m_wakeRequested))
+						break;
+
+					if(i % 64 == 0 && std::chrono::steady_clock::now() - start >= m_spinBudget)
+						break;
+
+					_CPUPause();
+				}
+
+				return found;
+			}
+
+			void
+			SignalShared(
+				size_t								aCount)
+			{
+				int64_t credits = m_sharedCredits.fetch_add((int64_t)aCount);
+
+				// Threads sleeping on the shared event get a token each, one write per thread since with exclusive 
+				// wake-ups each write only wakes one of them. Packets left over are taken by spinning threads, or by 
+				// threads about to sleep, which check first.
+				size_t sleepingCount = credits < 0 ? std::min<size_t>(aCount, (size_t)-credits) : 0;
+				for(size_t i = 0; i < sleepingCount; i++)
+					_SignalEventFd(m_eventFd, 1);
+
+				if(m_wakePolicy == WAKE_POLICY_LIFO && aCount > sleepingCount)
+					WakeParkedWorkers(aCount - sleepingCount);
+			}
+
+			void
+			RequestHelp()
+			{
+				// Idle workers of queues that take work from this one are sleeping, so wake one of them up
+				if(m_helperQueues.empty())
+					return;
+
+				Queue* helperQueue = m_helperQueues[m_nextHelperQueue++ % m_helperQueues.size()];
+				_SignalEventFd(helperQueue->m_internal->m_helpEventFd, 1);
+			}
+
+			void
+			ParkWorker(
+				Worker*								aWorker)
+			{
+				std::lock_guard lock(m_parkedWorkersLock);
+				assert(!aWorker->m_parked);
+
+				aWorker->m_parked = true;
+				m_parkedWorkers.push_back(aWorker);
+				m_parkedWorkerCount++;
+			}
+
+			void
+			UnparkWorker(
+				Worker*								aWorker)
+			{
+				std::lock_guard lock(m_parkedWorkersLock);
+
+				// Already unparked if it was woken up for shared packets
+				if(!aWorker->m_parked)
+					return;
+
+				aWorker->m_parked = false;
+				m_parkedWorkers.erase(std::find(m_parkedWorkers.begin(), m_parkedWorkers.end(), aWorker));
+				m_parkedWorkerCount--;
+			}
+
+			void
+			WakeParkedWorkers(
+				size_t								aCount)
+			{
+				// Workers check the shared queue after parking, so either they see the packets or we see them
+				if(m_parkedWorkerCount == 0)
+					return;
+
+				std::lock_guard lock(m_parkedWorkersLock);
+
+				for(size_t i = 0; i < aCount && !m_parkedWorkers.empty(); i++)
+				{
+					Worker* worker = m_parkedWorkers.back();
+					m_parkedWorkers.pop_back();
+					m_parkedWorkerCount--;
+
+					worker->m_parked = false;
+					_SignalEventFd(worker->m_eventFd, 1);
+				}
+			}
+
+			// Public data
+			int										m_eventFd = 0;
+			WakePolicy								m_wakePolicy = WAKE_POLICY_ANY;
+			std::chrono::microseconds				m_spinBudget = std::chrono::microseconds(0);
 			moodycamel::ConcurrentQueue<Packet>		m_concurrentQueue;
 			std::atomic_size_t						m_queueLength = 0;
+
+			// Packets in the shared queue that can be taken, minus threads sleeping on the shared event that haven't 
+			// been given a token yet. Every shared packet is taken with a credit, so the event never has fewer tokens 
+			// than there are sleeping threads owed one.
+			std::atomic_int64_t						m_sharedCredits = 0;
+			std::atomic_uint64_t					m_postedCount = 0;
+
+			std::mutex								m_workersLock;
+			std::unique_ptr<std::unique_ptr<Worker>[]>	m_workers;
+			std::atomic_size_t						m_workerCount = 0;
+			size_t									m_stealThreshold = DEFAULT_STEAL_THRESHOLD;
+
+			std::vector<Queue*>						m_remoteQueues;
+
+			// Queues that have this one as a remote queue, their workers are woken up when this one has a backlog
+			int										m_helpEventFd = -1;
+			std::vector<Queue*>						m_helperQueues;
+			std::atomic_size_t						m_nextHelperQueue = 0;
+
+			// Most recently parked last
+			std::mutex								m_parkedWorkersLock;
+			std::vector<Worker*>					m_parkedWorkers;
+			std::atomic_size_t						m_parkedWorkerCount = 0;
 		};
 	#endif
 
@@ -49,85 +504,407 @@ namespace nwork
 	Queue::Queue()
 		: m_forEachConcurrency(GetCPUCount() * 2)
 	{
-		#if defined(WIN32)
+		#if defined(WIN32)
+			{
+				m_iocpHandle = CreateIoCompletionPort(
+					INVALID_HANDLE_VALUE,
+					NULL,
+					NULL,
+					0);
+				assert(m_iocpHandle);
+			}
+		#else
+			m_internal = new Internal();
+			m_internal->m_workers = std::make_unique<std::unique_ptr<Worker>[]>(MAX_WORKERS);
+
+			{
+				m_epollFd = epoll_create1(0);
+				assert(m_epollFd >= 0);
+
+				m_eventFd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+				assert(m_eventFd >= 0);
+				m_internal->m_eventFd = m_eventFd;
+
+				m_internal->m_helpEventFd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+				assert(m_internal->m_helpEventFd >= 0);
+
+				// Registered file descriptors have their own epoll instance, which is nested in the one used by 
+				// threads that aren't workers and in the ones used by workers
+				m_ioEpollFd = epoll_create1(0);
+				assert(m_ioEpollFd >= 0);
+			}
+
+			_AddToEpoll(m_epollFd, m_eventFd, EPOLLIN | EPOLLEXCLUSIVE, NULL);
+			_AddToEpoll(m_epollFd, m_ioEpollFd, EPOLLIN, &g_ioEventTag);
+		#endif
+	}
+	
+	Queue::~Queue()
+	{
+		delete m_fiberPool.load();
+
+		#if !defined(WIN32)
+			delete m_internal;
+
+			if (m_epollFd >= 0)
+				close(m_epollFd);
+
+			if (m_eventFd >= 0)
+				close(m_eventFd);
+
+			if (m_ioEpollFd >= 0)
+				close(m_ioEpollFd);
+		#endif
+	}
+
+	void					
+	Queue::SetForEachConcurrency(
+		size_t				aForEachConcurrency)
+	{
+		assert(aForEachConcurrency > 0);
+		m_forEachConcurrency = aForEachConcurrency;
+	}
+
+	void					
+	Queue::SetIOFunction(
+		IOFunction			aIOFunction)
+	{
+		m_ioFunction = aIOFunction;
+	}
+
+	void
+	Queue::SetFiberStackSize(
+		size_t				aFiberStackSize)
+	{
+		// Can't be changed after fibers have been created
+		assert(m_fiberPool == NULL);
+		m_fiberStackSize = aFiberStackSize;
+	}
+
+	void
+	Queue::SetWorkerCount(
+		size_t				aWorkerCount)
+	{
+		#if !defined(WIN32)
+			std::lock_guard lock(m_internal->m_workersLock);
+			assert(aWorkerCount <= MAX_WORKERS);
+
+			size_t workerCount = m_internal->m_workerCount;
+
+			for(size_t i = workerCount; i < aWorkerCount; i++)
+			{
+				std::unique_ptr<Worker> worker = std::make_unique<Worker>();
+				worker->m_workQueue = this;
+				worker->m_index = i;
+
+				worker->m_epollFd = epoll_create1(0);
+				assert(worker->m_epollFd >= 0);
+
+				worker->m_eventFd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+				assert(worker->m_eventFd >= 0);
+
+				// With the LIFO policy workers are woken up through their own event for shared packets
+				if(m_internal->m_wakePolicy == WAKE_POLICY_ANY)
+					_AddToEpoll(worker->m_epollFd, m_eventFd, EPOLLIN | EPOLLEXCLUSIVE, NULL);
+
+				_AddToEpoll(worker->m_epollFd, worker->m_eventFd, EPOLLIN, &g_workerEventTag);
+				_AddToEpoll(worker->m_epollFd, m_internal->m_helpEventFd, EPOLLIN | EPOLLEXCLUSIVE, &g_helpEventTag);
+				_AddToEpoll(worker->m_epollFd, m_ioEpollFd, EPOLLIN, &g_ioEventTag);
+
+				m_internal->m_workers[i] = std::move(worker);
+			}
+
+			if(aWorkerCount > workerCount)
+				m_internal->m_workerCount = aWorkerCount;
+		#else
+			(void)aWorkerCount;
+		#endif
+	}
+
+	void
+	Queue::SetWakePolicy(
+		WakePolicy			aWakePolicy)
+	{
+		#if !defined(WIN32)
+			assert(m_internal->m_workerCount == 0 || m_internal->m_wakePolicy == aWakePolicy);
+
+			m_internal->m_wakePolicy = aWakePolicy;
+		#else
+			(void)aWakePolicy;
+		#endif
+	}
+
+	Queue::WakePolicy
+	Queue::GetWakePolicy() const
+	{
+		#if !defined(WIN32)
+			return m_internal->m_wakePolicy;
+		#else
+			return WAKE_POLICY_LIFO;
+		#endif
+	}
+
+	size_t
+	Queue::GetParkedWorkerCount() const
+	{
+		#if !defined(WIN32)
+			return m_internal->m_parkedWorkerCount;
+		#else
+			return 0;
+		#endif
+	}
+
+	void
+	Queue::SetSpinBudget(
+		std::chrono::microseconds	aSpinBudget)
+	{
+		#if !defined(WIN32)
+			m_internal->m_spinBudget = aSpinBudget;
+		#else
+			(void)aSpinBudget;
+		#endif
+	}
+
+	void
+	Queue::SetStealThreshold(
+		size_t				aStealThreshold)
+	{
+		#if !defined(WIN32)
+			m_internal->m_stealThreshold = aStealThreshold;
+		#else
+			(void)aStealThreshold;
+		#endif
+	}
+
+	void
+	Queue::AttachWorker(
+		size_t				aWorkerIndex)
+	{
+		#if !defined(WIN32)
+			assert(aWorkerIndex < m_internal->m_workerCount);
+			assert(t_currentWorker == NULL);
+
+			Worker* worker = m_internal->m_workers[aWorkerIndex].get();
+
+			bool wasAttached = worker->m_attached.exchange(true);
+			(void)wasAttached;
+			assert(!wasAttached);
+
+			t_currentWorker = worker;
+		#else
+			(void)aWorkerIndex;
+		#endif
+	}
+
+	void
+	Queue::DetachWorker()
+	{
+		#if !defined(WIN32)
+			assert(t_currentWorker != NULL && t_currentWorker->m_workQueue == this);
+
+			// Affinity packets posted from now on go to the shared queue, see PostPacketWithAffinity()
+			t_currentWorker->m_attached = false;
+			t_currentWorker->m_stopPending = false;
+			m_internal->MoveLocalPackets(t_currentWorker, true);
+
+			t_currentWorker = NULL;
+		#endif
+	}
+
+	size_t
+	Queue::GetWorkerCount() const
+	{
+		#if !defined(WIN32)
+			return m_internal->m_workerCount;
+		#else
+			return 0;
+		#endif
+	}
+
+	bool
+	Queue::IsWorkerThread() const
+	{
+		#if !defined(WIN32)
+			return t_currentWorker != NULL && t_currentWorker->m_workQueue == this;
+		#else
+			return false;
+		#endif
+	}
+
+	void
+	Queue::WakeWorker(
+		size_t				aWorkerIndex)
+	{
+		#if !defined(WIN32)
+			assert(aWorkerIndex < m_internal->m_workerCount);
+
+			Worker* worker = m_internal->m_workers[aWorkerIndex].get();
+			worker->m_wakeRequested = true;
+			_SignalEventFd(worker->m_eventFd, 1);
+		#else
+			(void)aWorkerIndex;
+		#endif
+	}
+
+	void
+	Queue::SetRemoteQueues(
+		std::vector<Queue*>	aRemoteQueues)
+	{
+		#if !defined(WIN32)
+			for(Queue* remoteQueue : m_internal->m_remoteQueues)
+			{
+				std::vector<Queue*>& helperQueues = remoteQueue->m_internal->m_helperQueues;
+				helperQueues.erase(std::remove(helperQueues.begin(), helperQueues.end(), this), helperQueues.end());
+			}
+
+			for(Queue* remoteQueue : aRemoteQueues)
+				remoteQueue->m_internal->m_helperQueues.push_back(this);
+
+			m_internal->m_remoteQueues = std::move(aRemoteQueues);
+		#else
+			// Not possible to take packets from another completion port without blocking
+			(void)aRemoteQueues;
+		#endif
+	}
+
+	size_t
+	Queue::GetQueuedPacketCount() const
+	{
+		#if !defined(WIN32)
+			return m_internal->m_queueLength;
+		#else
+			return 0;
+		#endif
+	}
+
+	uint64_t
+	Queue::GetPostedPacketCount() const
+	{
+		#if !defined(WIN32)
+			return m_internal->m_postedCount;
+		#else
+			return 0;
+		#endif
+	}
+
+	size_t
+	Queue::GetLocalPacketCount() const
+	{
+		#if !defined(WIN32)
+			if(!IsWorkerThread())
+				return 0;
+
+			return t_currentWorker->m_inboxLength + t_currentWorker->m_affinityQueueLength;
+		#else
+			return 0;
+		#endif
+	}
+
+	void
+	Queue::PostPacket(
+		const Packet&		aPacket)
+	{
+		#if defined(WIN32)
+			assert(m_iocpHandle);
+
+			BOOL ok = PostQueuedCompletionStatus(m_iocpHandle, (DWORD)aPacket.m_header, (ULONG_PTR)aPacket.m_pointer1, (LPOVERLAPPED)aPacket.m_pointer2);
+			(void)ok;
+			assert(ok != 0);
+		#else
+			assert(m_eventFd != 0);
+
+			// Stop packets go to worker inboxes
+			assert(!_IsStopPacket(aPacket));
+
+			m_internal->m_postedCount++;
+			m_internal->PostShared(aPacket);
+		#endif
+	}
+
+	void
+	Queue::PostPacketWithAffinity(
+		uint64_t			aKey,
+		const Packet&		aPacket)
+	{
+		#if !defined(WIN32)
+			size_t workerCount = m_internal->m_workerCount;
+			if(workerCount == 0)
 			{
-				m_iocpHandle = CreateIoCompletionPort(
-					INVALID_HANDLE_VALUE,
-					NULL,
-					NULL,
-					0);
-				assert(m_iocpHandle);
+				PostPacket(aPacket);
+				return;
 			}
-		#else
-			m_internal = new Internal();
 
-			{
-				m_epollFd = epoll_create1(0);
-				assert(m_epollFd >= 0);
+			assert(!_IsStopPacket(aPacket));
 
-				m_eventFd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
-				assert(m_eventFd >= 0);
-			}
+			Worker* worker = m_internal->m_workers[_GetAffinityWorkerIndex(aKey, workerCount)].get();
+			worker->m_affinityQueue.enqueue(aPacket);
+			size_t length = ++worker->m_affinityQueueLength;
 
+			// Worker detached before or while we posted, either we see it or it sees our packet
+			if(!worker->m_attached)
 			{
-				struct epoll_event t;
-				memset(&t, 0, sizeof(epoll_event));
-				t.events = EPOLLIN | EPOLLEXCLUSIVE;
-				t.data.ptr = NULL;
-
-				int result = epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &t);
-				assert(result == 0);
+				m_internal->MoveLocalPackets(worker, false);
+				return;
 			}
-		#endif
-	}
-	
-	Queue::~Queue()
-	{
-		#if !defined(WIN32)
-			delete m_internal;
 
-			if (m_epollFd >= 0)
-				close(m_epollFd);
+			_SignalEventFd(worker->m_eventFd, 1);
 
-			if (m_eventFd >= 0)
-				close(m_eventFd);
+			// Wake up another worker when crossing the steal threshold, it will steal when it finds its own queue empty. 
+			// Same if the worker is busy and this is the only packet, in case it's blocked.
+			if(workerCount > 1 && (length == m_internal->m_stealThreshold + 1 || (length == 1 && worker->m_busySince != 0)))
+				_SignalEventFd(m_internal->m_workers[(worker->m_index + 1) % workerCount]->m_eventFd, 1);
+		#else
+			// No worker-local queues with IOCP
+			(void)aKey;
+			PostPacket(aPacket);
 		#endif
 	}
 
-	void					
-	Queue::SetForEachConcurrency(
-		size_t				aForEachConcurrency)
+	void
+	Queue::PostPacketToWorker(
+		size_t				aWorkerIndex,
+		const Packet&		aPacket)
 	{
-		assert(aForEachConcurrency > 0);
-		m_forEachConcurrency = aForEachConcurrency;
-	}
+		#if !defined(WIN32)
+			assert(aWorkerIndex < m_internal->m_workerCount);
 
-	void					
-	Queue::SetIOFunction(
-		IOFunction			aIOFunction)
-	{
-		m_ioFunction = aIOFunction;
+			Worker* worker = m_internal->m_workers[aWorkerIndex].get();
+			worker->m_inbox.enqueue(aPacket);
+			worker->m_inboxLength++;
+
+			_SignalEventFd(worker->m_eventFd, 1);
+		#else
+			// Not possible to target a specific thread with IOCP
+			(void)aWorkerIndex;
+			PostPacket(aPacket);
+		#endif
 	}
 
 	void
-	Queue::PostPacket(
-		const Packet&		aPacket)
+	Queue::PostPackets(
+		const Packet*		aPackets,
+		size_t				aCount)
 	{
-		#if defined(WIN32)
-			assert(m_iocpHandle);
+		if(aCount == 0)
+			return;
 
-			BOOL ok = PostQueuedCompletionStatus(m_iocpHandle, (DWORD)aPacket.m_header, (ULONG_PTR)aPacket.m_pointer1, (LPOVERLAPPED)aPacket.m_pointer2);
-			(void)ok;
-			assert(ok != 0);
+		#if defined(WIN32)
+			for(size_t i = 0; i < aCount; i++)
+				PostPacket(aPackets[i]);
 		#else
 			assert(m_eventFd != 0);
 
-			m_internal->m_concurrentQueue.enqueue(aPacket);
-			m_internal->m_queueLength++;
+			bool ok = m_internal->m_concurrentQueue.enqueue_bulk(aPackets, aCount);
+			(void)ok;
+			assert(ok);
+			size_t length = m_internal->m_queueLength += aCount;
+			m_internal->m_postedCount += aCount;
+
+			// Wakes up as many sleeping threads as there are packets, not one per packet
+			m_internal->SignalShared(aCount);
 
-			uint64_t v = 1;
-			ssize_t bytes = write(m_eventFd, &v, sizeof(v));
-			assert(bytes == sizeof(v));
+			if(length > m_internal->m_stealThreshold && length - aCount <= m_internal->m_stealThreshold)
+				m_internal->RequestHelp();
 		#endif
 	}
 
@@ -135,12 +912,47 @@ namespace nwork
 	Queue::WaitAndExecute(
 		uint32_t			aMaxWaitTime)
 	{
+		#if !defined(WIN32)
+			if(t_executeDepth == 0 && IsWorkerThread() && t_currentWorker->m_stopPending)
+			{
+				t_currentWorker->m_stopPending = false;
+				return WAIT_RESULT_STOPPED;
+			}
+		#endif
+
 		Packet packet;
 		WaitResult result = _WaitForPacket(aMaxWaitTime, packet);
 		if(result != WAIT_RESULT_OK)
 			return result;
 
+		if(_IsStopPacket(packet))
+		{
+			if(t_executeDepth == 0)
+				return WAIT_RESULT_STOPPED;
+
+			// Whoever sent it is waiting for the outermost loop of this thread to stop. Only workers get them from 
+			// their inbox, which keep it aside instead of taking it again and again while helping. With IOCP it goes 
+			// back to the shared queue.
+			#if !defined(WIN32)
+				assert(IsWorkerThread());
+				t_currentWorker->m_stopPending = true;
+			#else
+				PostPacket(packet);
+			#endif
+
+			return WAIT_RESULT_TIMED_OUT;
+		}
+
 		uint32_t size = packet.m_header & 0x0FFFFFFF;
+
+		#if !defined(WIN32)
+			// Lets other workers steal from its affinity queue if this takes long
+			Worker* busyWorker = t_executeDepth == 0 && IsWorkerThread() ? t_currentWorker : NULL;
+			if(busyWorker != NULL)
+				busyWorker->m_busySince = _GetBusyTime();
+		#endif
+
+		t_executeDepth++;
 			
 		if(size == 0x0FFFFFFF)
 		{
@@ -182,7 +994,10 @@ namespace nwork
 				{
 					std::function<void()>* p = (std::function<void()>*)packet.m_pointer1;
 					assert(p != NULL);
-					p->operator()();
+
+					// Functions of cancelled groups are skipped, but still completed
+					if(!(packet.m_header & FUNCTION_FLAG_GROUP) || !((Group*)packet.m_pointer2)->IsCancelled())
+						p->operator()();
 
 					if(packet.m_header & FUNCTION_FLAG_DELETE)
 						delete p;
@@ -191,10 +1006,12 @@ namespace nwork
 					{
 						if(packet.m_header & FUNCTION_FLAG_GROUP)
 						{
+							// Group might not exist anymore after completion unless we hold a reference to it
 							Group* group = (Group*)packet.m_pointer2;
+							bool isReferencedPerTask = group->IsReferencedPerTask();
 							group->OnCompletion();
 
-							if(group->IsReferenceCounted())
+							if(isReferencedPerTask)
 								group->RemoveReference();
 						}
 						else
@@ -207,6 +1024,19 @@ namespace nwork
 				break;
 
 			case TYPE_OBJECT:
+				if(packet.m_header & OBJECT_FLAG_CALLBACK)
+				{
+					Callback callback = reinterpret_cast<Callback>(packet.m_pointer2);
+					assert(callback != NULL);
+					callback(packet.m_pointer1);
+				}
+				else if(packet.m_header & OBJECT_FLAG_FIBER)
+				{
+					Object* p = (Object*)packet.m_pointer1;
+					assert(p != NULL);
+					_GetFiberPool()->Execute(p);
+				}
+				else
 				{
 					Object* p = (Object*)packet.m_pointer1;
 					assert(p != NULL);
@@ -226,6 +1056,13 @@ namespace nwork
 
 			m_ioFunction(size, packet.m_pointer2);
 		}
+
+		t_executeDepth--;
+
+		#if !defined(WIN32)
+			if(busyWorker != NULL)
+				busyWorker->m_busySince = 0;
+		#endif
 		
 		return WAIT_RESULT_OK;
 	}
@@ -285,6 +1122,43 @@ namespace nwork
 		PostPacket(packet);
 	}
 
+	void
+	Queue::PostFunctionToWorker(
+		size_t									aWorkerIndex,
+		std::function<void()>					aFunction)
+	{
+		std::function<void()>* f = new std::function<void()>();
+		*f = std::move(aFunction);
+
+		Packet packet;
+		packet.m_header = MakeHeader(TYPE_FUNCTION, FUNCTION_FLAG_DELETE);
+		packet.m_pointer1 = (void*)f;
+		PostPacketToWorker(aWorkerIndex, packet);
+	}
+
+	void
+	Queue::PostFunctionToWorkerWithGroup(
+		size_t									aWorkerIndex,
+		Group*									aGroup,
+		std::function<void()>					aFunction)
+	{
+		PostPacketToWorker(aWorkerIndex, _MakeFunctionPacketWithGroup(aGroup, std::move(aFunction)));
+	}
+
+	void
+	Queue::PostWithAffinity(
+		uint64_t								aKey,
+		std::function<void()>					aFunction)
+	{
+		std::function<void()>* f = new std::function<void()>();
+		*f = std::move(aFunction);
+
+		Packet packet;
+		packet.m_header = MakeHeader(TYPE_FUNCTION, FUNCTION_FLAG_DELETE);
+		packet.m_pointer1 = (void*)f;
+		PostPacketWithAffinity(aKey, packet);
+	}
+
 	void					
 	Queue::PostFunctionWithSemaphore(
 		std::counting_semaphore<>*				aSemaphore,
@@ -305,19 +1179,45 @@ namespace nwork
 		Group*									aGroup,
 		std::function<void()>					aFunction)
 	{	
-		if(aGroup->IsReferenceCounted())
-			aGroup->AddReference();
+		PostPacket(_MakeFunctionPacketWithGroup(aGroup, std::move(aFunction)));
+	}
 
-		aGroup->OnPost();
+	void
+	Queue::PostFunctionsWithGroup(
+		Group*									aGroup,
+		std::span<std::function<void()>>		aFunctions)
+	{
+		// Functions are executed in place, so they must stay alive until the group has completed
+		if(aFunctions.empty())
+			return;
 
-		std::function<void()>* f = new std::function<void()>();
-		*f = std::move(aFunction);
+		uint32_t count = (uint32_t)aFunctions.size();
 
-		Packet packet;
-		packet.m_header = MakeHeader(TYPE_FUNCTION, FUNCTION_FLAG_DELETE | FUNCTION_FLAG_GROUP);
-		packet.m_pointer1 = (void*)f;
-		packet.m_pointer2 = (void*)aGroup;
-		PostPacket(packet);
+		if(aGroup->IsReferencedPerTask())
+			aGroup->AddReference(count);
+
+		aGroup->OnPost(count);
+
+		// Posted with a single bulk enqueue, packets only go to the heap for large batches
+		static const size_t STACK_PACKET_COUNT = 64;
+		Packet stackPackets[STACK_PACKET_COUNT];
+		std::unique_ptr<Packet[]> heapPackets;
+		Packet* packets = stackPackets;
+
+		if(aFunctions.size() > STACK_PACKET_COUNT)
+		{
+			heapPackets = std::make_unique<Packet[]>(aFunctions.size());
+			packets = heapPackets.get();
+		}
+
+		for(size_t i = 0; i < aFunctions.size(); i++)
+		{
+			packets[i].m_header = MakeHeader(TYPE_FUNCTION, FUNCTION_FLAG_GROUP);
+			packets[i].m_pointer1 = (void*)&aFunctions[i];
+			packets[i].m_pointer2 = (void*)aGroup;
+		}
+
+		PostPackets(packets, aFunctions.size());
 	}
 
 	void					
@@ -346,6 +1246,7 @@ namespace nwork
 	Queue::PostObject(
 		Object*									aObject)
 	{
+		assert(aObject != NULL);
 		aObject->BeforePost();
 
 		Packet packet;
@@ -354,6 +1255,105 @@ namespace nwork
 		PostPacket(packet);
 	}
 
+	void
+	Queue::PostObjectAsFiber(
+		Object*									aObject)
+	{
+		assert(aObject != NULL);
+		aObject->BeforePost();
+
+		Packet packet;
+		packet.m_header = MakeHeader(TYPE_OBJECT, OBJECT_FLAG_FIBER);
+		packet.m_pointer1 = (void*)aObject;
+		PostPacket(packet);
+	}
+
+	void
+	Queue::PostCallback(
+		Callback								aCallback,
+		void*									aContext)
+	{
+		PostPacket(MakeCallbackPacket(aCallback, aContext));
+	}
+
+	void
+	Queue::PostCoroutine(
+		std::coroutine_handle<>					aHandle)
+	{
+		PostPacket(MakeCoroutinePacket(aHandle));
+	}
+
+	ScheduleAwaiter
+	Queue::Schedule()
+	{
+		return ScheduleAwaiter(this);
+	}
+
+	Queue::Packet
+	Queue::MakeCoroutinePacket(
+		std::coroutine_handle<>					aHandle)
+	{
+		return MakeCallbackPacket(_ResumeCoroutine, aHandle.address());
+	}
+
+	Queue::Packet
+	Queue::MakeStopPacket()
+	{
+		return { MakeHeader(TYPE_OBJECT, 0), &g_stopPacketTag, NULL };
+	}
+
+	#if !defined(WIN32)
+
+		void
+		Queue::RegisterFd(
+			int									aFd)
+		{
+			// Registered disarmed, ArmFd() enables it for a single event
+			struct epoll_event t;
+			memset(&t, 0, sizeof(epoll_event));
+			t.events = EPOLLONESHOT;
+			t.data.ptr = NULL;
+
+			int result = epoll_ctl(m_ioEpollFd, EPOLL_CTL_ADD, aFd, &t);
+			(void)result;
+			assert(result == 0);
+		}
+
+		void
+		Queue::UnregisterFd(
+			int									aFd)
+		{
+			int result = epoll_ctl(m_ioEpollFd, EPOLL_CTL_DEL, aFd, NULL);
+			(void)result;
+			assert(result == 0);
+		}
+
+		void
+		Queue::ArmFd(
+			int									aFd,
+			uint32_t							aEvents,
+			FdWaiter*							aWaiter)
+		{
+			struct epoll_event t;
+			memset(&t, 0, sizeof(epoll_event));
+			t.events = aEvents | EPOLLONESHOT;
+			t.data.ptr = aWaiter;
+
+			int result = epoll_ctl(m_ioEpollFd, EPOLL_CTL_MOD, aFd, &t);
+			(void)result;
+			assert(result == 0);
+		}
+
+		FdAwaiter
+		Queue::WaitForFd(
+			int									aFd,
+			uint32_t							aEvents)
+		{
+			return FdAwaiter(this, aFd, aEvents);
+		}
+
+	#endif
+
 	//------------------------------------------------------------------------------------------------
 
 	Queue::WaitResult
@@ -386,44 +1386,215 @@ namespace nwork
 			assert(m_epollFd != 0);
 			assert(m_eventFd != 0);
 
+			Worker* worker = t_currentWorker != NULL && t_currentWorker->m_workQueue == this ? t_currentWorker : NULL;
+			int epollFd = worker != NULL ? worker->m_epollFd : m_epollFd;
+
+			// Worker epoll doesn't have the shared event
+			bool parking = worker != NULL && m_internal->m_wakePolicy == WAKE_POLICY_LIFO;
+
+			// Shared, worker, help and IO events
+			struct epoll_event events[4];
 			struct epoll_event t;
 			
 			{
-				int result = epoll_wait(m_epollFd, &t, 1, aMaxWaitTime);
-				if (result == -1 && errno == EINTR)
+				// Events are checked without blocking first, unless nothing can be ready other than help and IO events. 
+				// Those are picked up by the blocking wait just as well.
+				bool probe = aMaxWaitTime == 0 || m_internal->m_sharedCredits > 0 
+					|| (worker != NULL && (worker->m_inboxLength > 0 || worker->m_affinityQueueLength > 0 || worker->m_wakeRequested));
+
+				int result = probe ? epoll_wait(epollFd, events, 4, 0) : 0;
+
+				// Tokens of the shared event belong to threads that have registered to sleep on it
+				if (!_FindEvent(events, result, t, NULL))
+				{
+					if(m_internal->TryDequeueShared(aOut))
+						return WAIT_RESULT_OK;
+
+					// Nothing ready, take work from overloaded workers before going to sleep
+					bool busyVictim = false;
+					if(m_internal->StealPacket(worker, aOut, &busyVictim))
+						return WAIT_RESULT_OK;
+
+					for(Queue* remoteQueue : m_internal->m_remoteQueues)
+					{
+						if(remoteQueue->m_internal->TryDequeueShared(aOut))
+							return WAIT_RESULT_OK;
+					}
+
+					if(aMaxWaitTime == 0)
+						return WAIT_RESULT_TIMED_OUT;
+
+					if(m_internal->m_spinBudget.count() > 0 && m_internal->SpinForPacket(worker, aOut))
+						return WAIT_RESULT_OK;
+
+					if(parking)
+					{
+						// Packets posted before we were on the stack didn't wake anyone up
+						m_internal->ParkWorker(worker);
+
+						if(m_internal->TryDequeueShared(aOut))
+						{
+							m_internal->UnparkWorker(worker);
+							return WAIT_RESULT_OK;
+						}
+					}
+					else if(m_internal->BeginSharedWait())
+					{
+						m_internal->DequeueSharedWithCredit(aOut);
+						return WAIT_RESULT_OK;
+					}
+
+					// Wake up in time to steal from a worker that might be blocked
+					int waitTime = aMaxWaitTime == WAIT_INFINITE ? -1 : (int)aMaxWaitTime;
+					if(busyVictim && (waitTime < 0 || waitTime > (int)STEAL_BUSY_TIME.count()))
+						waitTime = (int)STEAL_BUSY_TIME.count();
+
+					result = epoll_wait(epollFd, events, 4, waitTime);
+					assert(result >= 0 || errno == EINTR);
+
+					bool signaled = false;
+					bool found = _FindEvent(events, result, t, &signaled);
+
+					// Shared packet comes first, anything else is still there next time
+					if(parking)
+					{
+						m_internal->UnparkWorker(worker);
+					}
+					else if(m_internal->EndSharedWait(signaled))
+					{
+						m_internal->DequeueSharedWithCredit(aOut);
+						return WAIT_RESULT_OK;
+					}
+
+					if (!found)
+						return WAIT_RESULT_TIMED_OUT;
+				}
+			}
+
+			if (t.data.ptr == &g_workerEventTag)
+			{
+				assert(worker != NULL);
+
+				uint64_t v = 0;
+				ssize_t bytes = read(worker->m_eventFd, &v, sizeof(v));
+				if(bytes < 0)
 					return WAIT_RESULT_TIMED_OUT;
 
-				assert(result >= 0);
+				worker->m_wakeRequested = false;
 
-				if (result == 0)
+				// Packet might have been stolen, or another worker wants us to steal
+				if(!Internal::DequeuePacket(worker->m_inbox, worker->m_inboxLength, aOut) 
+					&& !Internal::DequeuePacket(worker->m_affinityQueue, worker->m_affinityQueueLength, aOut) 
+					&& !(parking && m_internal->TryDequeueShared(aOut))
+					&& !m_internal->StealPacket(worker, aOut))
 					return WAIT_RESULT_TIMED_OUT;
 			}
-
-			if (t.data.ptr == NULL)
+			else if (t.data.ptr == &g_helpEventTag)
 			{
+				assert(worker != NULL);
+
 				uint64_t v = 0;
-				ssize_t bytes = read(m_eventFd, &v, sizeof(v));
+				ssize_t bytes = read(m_internal->m_helpEventFd, &v, sizeof(v));
 				if(bytes < 0)
 					return WAIT_RESULT_TIMED_OUT;
 
-				while(m_internal->m_queueLength > 0)
+				for(Queue* remoteQueue : m_internal->m_remoteQueues)
 				{
-					if(m_internal->m_concurrentQueue.try_dequeue(aOut))
-						break;
+					if(remoteQueue->m_internal->TryDequeueShared(aOut))
+					{
+						// Still more than one thread can take care of, so get another one of us to help too
+						if(remoteQueue->m_internal->m_queueLength > remoteQueue->m_internal->m_stealThreshold)
+							_SignalEventFd(m_internal->m_helpEventFd, 1);
+
+						return WAIT_RESULT_OK;
+					}
 				}
 
-				assert(m_internal->m_queueLength > 0);
-				m_internal->m_queueLength--;
+				return WAIT_RESULT_TIMED_OUT;
 			}
 			else
 			{
-				assert(false);
+				assert(t.data.ptr == &g_ioEventTag);
+
+				// All waiting threads are woken up, but only one of them will get the event
+				if(epoll_wait(m_ioEpollFd, &t, 1, 0) != 1)
+					return WAIT_RESULT_TIMED_OUT;
+
+				// Registered file descriptor became ready, it stays disarmed until armed again
+				FdWaiter* waiter = (FdWaiter*)t.data.ptr;
+				aOut = waiter->m_packet;
+				waiter->m_events = t.events;
 			}
 
 			return WAIT_RESULT_OK;
 		#endif
 	}
 
+	Queue::Packet
+	Queue::_MakeFunctionPacketWithGroup(
+		Group*					aGroup,
+		std::function<void()>	aFunction)
+	{
+		if(aGroup->IsReferencedPerTask())
+			aGroup->AddReference();
+
+		aGroup->OnPost();
+
+		std::function<void()>* f = new std::function<void()>();
+		*f = std::move(aFunction);
+
+		Packet packet;
+		packet.m_header = MakeHeader(TYPE_FUNCTION, FUNCTION_FLAG_DELETE | FUNCTION_FLAG_GROUP);
+		packet.m_pointer1 = (void*)f;
+		packet.m_pointer2 = (void*)aGroup;
+		return packet;
+	}
+
+	void
+	Queue::_Invoke(
+		std::function<void()>*	aFunctions,
+		size_t					aCount)
+	{
+		assert(aCount > 0);
+
+		// Branches refer to the functions on our stack, so they neither need to be deleted nor hold a group reference
+		Group group(Group::FLAG_FIXED_SIZE, (uint32_t)(aCount - 1));
+
+		for(size_t i = 0; i < aCount - 1; i++)
+		{
+			Packet packet;
+			packet.m_header = MakeHeader(TYPE_FUNCTION, FUNCTION_FLAG_GROUP);
+			packet.m_pointer1 = (void*)&aFunctions[i];
+			packet.m_pointer2 = (void*)&group;
+			PostPacket(packet);
+		}
+
+		aFunctions[aCount - 1]();
+
+		group.WaitAndHelp(this);
+	}
+
+	FiberPool*
+	Queue::_GetFiberPool()
+	{
+		FiberPool* fiberPool = m_fiberPool.load();
+		if(fiberPool != NULL)
+			return fiberPool;
+
+		FiberPool* newFiberPool = new FiberPool(this);
+		if(m_fiberStackSize > 0)
+			newFiberPool->SetStackSize(m_fiberStackSize);
+
+		// Another thread might have created one at the same time
+		if(!m_fiberPool.compare_exchange_strong(fiberPool, newFiberPool))
+		{
+			delete newFiberPool;
+			return fiberPool;
+		}
+
+		return newFiberPool;
+	}
+
 	void		
 	Queue::_ForEachVector(
 		ForEachVectorContext*	aContext,
@@ -0,0 +1,54 @@
+#include "Pcheader.h"
+
+#include <nwork/Strand.h>
+
+namespace nwork
+{
+
+	struct Strand::Task
+		: public MailboxObject::Message
+	{
+		std::function<void()>						m_function;
+	};
+
+	//------------------------------------------------------------------------------------------------
+
+	Strand::Strand(
+		Queue*										aWorkQueue)
+		: MailboxObject(aWorkQueue)
+	{
+
+	}
+
+	Strand::~Strand()
+	{
+
+	}
+
+	void
+	Strand::Post(
+		std::function<void()>						aFunction)
+	{
+		Task* task = new Task();
+		task->m_function = std::move(aFunction);
+		Send(task);
+	}
+
+	void
+	Strand::Dispatch(
+		std::function<void()>						aFunction)
+	{
+		if(IsCurrent())
+			aFunction();
+		else
+			Post(std::move(aFunction));
+	}
+
+	void
+	Strand::OnMessage(
+		Message*									aMessage)
+	{
+		((Task*)aMessage)->m_function();
+	}
+
+}
\ No newline at end of file
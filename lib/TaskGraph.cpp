@@ -0,0 +1,247 @@
+#include "Pcheader.h"
+
+#include <nwork/Group.h>
+#include <nwork/Object.h>
+#include <nwork/Queue.h>
+#include <nwork/TaskGraph.h>
+
+namespace nwork
+{
+
+	// Nodes consist of one or more parts, which are executed in parallel
+	struct TaskGraph::Part
+		: public Object
+	{
+		// Object implementation
+		void ExecuteWork() override;
+		void AfterExecute() override;
+
+		// Public data
+		Node*										m_node = NULL;
+		std::function<void()>						m_function;
+	};
+
+	struct TaskGraph::Node
+	{
+		void
+		Post()
+		{
+			m_pendingParts = (uint32_t)m_parts.size();
+
+			for(Part& part : m_parts)
+				m_workQueue->PostObject(&part);
+		}
+
+		void
+		OnCompleted()
+		{
+			m_endTime = std::chrono::steady_clock::now();
+
+			for(Node* successor : m_successors)
+			{
+				if(--successor->m_pendingPredecessors == 0)
+					successor->Post();
+			}
+
+			// Group might not exist anymore after completion unless we hold a reference to it
+			Group* group = m_group;
+			bool isReferencedPerTask = group->IsReferencedPerTask();
+			group->OnCompletion();
+
+			if(isReferencedPerTask)
+				group->RemoveReference();
+		}
+
+		// Public data
+		Queue*										m_workQueue = NULL;
+		std::vector<Part>							m_parts;
+		std::vector<Node*>							m_successors;
+		uint32_t									m_predecessorCount = 0;
+		std::atomic_uint32_t						m_pendingPredecessors = 0;
+		std::atomic_uint32_t						m_pendingParts = 0;
+		std::atomic_uint32_t						m_startedParts = 0;
+		Group*										m_group = NULL;
+
+		std::chrono::steady_clock::time_point		m_startTime;
+		std::chrono::steady_clock::time_point		m_endTime;
+		std::atomic_int64_t							m_executionTime = 0;
+	};
+
+	void
+	TaskGraph::Part::ExecuteWork()
+	{
+		std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+		if(m_node->m_startedParts++ == 0)
+			m_node->m_startTime = startTime;
+
+		if(!m_node->m_group->IsCancelled())
+			m_function();
+
+		m_node->m_executionTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+	}
+
+	void
+	TaskGraph::Part::AfterExecute()
+	{
+		if(--m_node->m_pendingParts == 0)
+			m_node->OnCompleted();
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	TaskGraph::TaskGraph(
+		Queue*										aWorkQueue)
+		: m_workQueue(aWorkQueue)
+	{
+
+	}
+
+	TaskGraph::~TaskGraph()
+	{
+
+	}
+
+	TaskGraph::NodeId
+	TaskGraph::AddNode(
+		std::function<void()>						aFunction)
+	{
+		std::vector<std::function<void()>> functions;
+		functions.push_back(std::move(aFunction));
+		return _AddNode(functions);
+	}
+
+	TaskGraph::NodeId
+	TaskGraph::AddFanOutNode(
+		std::vector<std::function<void()>>			aFunctions)
+	{
+		return _AddNode(aFunctions);
+	}
+
+	TaskGraph::NodeId
+	TaskGraph::AddForEachInRangeNode(
+		int32_t										aMin,
+		int32_t										aMax,
+		std::function<void(int32_t)>				aFunction)
+	{
+		assert(aMax >= aMin);
+
+		// Split into parts the same way as Queue::ForEachInRange(), all parts share the function
+		std::shared_ptr<std::function<void(int32_t)>> function = std::make_shared<std::function<void(int32_t)>>(std::move(aFunction));
+		std::vector<std::function<void()>> functions;
+
+		int32_t count = aMax - aMin + 1;
+		int32_t step = count / (int32_t)m_workQueue->GetForEachConcurrency();
+		if(step == 0)
+			step = 1;
+
+		for(int32_t workMin = aMin; workMin <= aMax; workMin += step)
+		{
+			int32_t workMax = std::min(workMin + step - 1, aMax);
+
+			functions.push_back([function, workMin, workMax]()
+			{
+				for(int32_t i = workMin; i <= workMax; i++)
+					function->operator()(i);
+			});
+
+			if(workMax == aMax)
+				break;
+		}
+
+		return _AddNode(functions);
+	}
+
+	void
+	TaskGraph::AddDependency(
+		NodeId										aNodeId,
+		NodeId										aDependsOnNodeId)
+	{
+		assert(aNodeId < m_nodes.size());
+		assert(aDependsOnNodeId < m_nodes.size());
+		assert(aNodeId != aDependsOnNodeId);
+
+		m_nodes[aDependsOnNodeId]->m_successors.push_back(m_nodes[aNodeId].get());
+		m_nodes[aNodeId]->m_predecessorCount++;
+	}
+
+	void
+	TaskGraph::Post(
+		Group*										aGroup)
+	{
+		if(aGroup->IsReferencedPerTask())
+			aGroup->AddReference((uint32_t)m_nodes.size());
+
+		aGroup->OnPost((uint32_t)m_nodes.size());
+
+		// All counters must be reset before anything is posted
+		for(std::unique_ptr<Node>& node : m_nodes)
+		{
+			node->m_group = aGroup;
+			node->m_pendingPredecessors = node->m_predecessorCount;
+			node->m_startedParts = 0;
+			node->m_executionTime = 0;
+		}
+
+		bool hasRoot = false;
+
+		for(std::unique_ptr<Node>& node : m_nodes)
+		{
+			if(node->m_predecessorCount == 0)
+			{
+				node->Post();
+				hasRoot = true;
+			}
+		}
+
+		// Graph must be acyclic
+		assert(hasRoot || m_nodes.empty());
+		(void)hasRoot;
+	}
+
+	void
+	TaskGraph::Run()
+	{
+		Group group(Group::FLAG_FIXED_SIZE, (uint32_t)m_nodes.size());
+		Post(&group);
+		group.Wait();
+	}
+
+	TaskGraph::NodeTiming
+	TaskGraph::GetNodeTiming(
+		NodeId										aNodeId) const
+	{
+		assert(aNodeId < m_nodes.size());
+		const Node* node = m_nodes[aNodeId].get();
+
+		NodeTiming timing;
+		timing.m_startTime = node->m_startTime;
+		timing.m_endTime = node->m_endTime;
+		timing.m_executionTime = std::chrono::nanoseconds(node->m_executionTime.load());
+		return timing;
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	TaskGraph::NodeId
+	TaskGraph::_AddNode(
+		std::vector<std::function<void()>>&			aFunctions)
+	{
+		assert(aFunctions.size() > 0);
+
+		std::unique_ptr<Node> node = std::make_unique<Node>();
+		node->m_workQueue = m_workQueue;
+		node->m_parts.resize(aFunctions.size());
+
+		for(size_t i = 0; i < aFunctions.size(); i++)
+		{
+			node->m_parts[i].m_node = node.get();
+			node->m_parts[i].m_function = std::move(aFunctions[i]);
+		}
+
+		NodeId nodeId = (NodeId)m_nodes.size();
+		m_nodes.push_back(std::move(node));
+		return nodeId;
+	}
+
+}
\ No newline at end of file
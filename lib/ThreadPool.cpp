@@ -1,38 +1,472 @@
 #include "Pcheader.h"
 
+#include <nwork/Group.h>
 #include <nwork/Queue.h>
 #include <nwork/ThreadPool.h>
+#include <nwork/Topology.h>
 
 namespace nwork
 {
 
+	namespace
+	{
+
+		thread_local ThreadPool* t_currentThreadPool = NULL;
+
+		// Threads with worker-local queues are woken up when stopping, others (and all with IOCP) check regularly
+		#if defined(WIN32)
+			const uint32_t WORKER_WAIT_TIME = 100;
+		#else
+			const uint32_t WORKER_WAIT_TIME = Queue::WAIT_INFINITE;
+		#endif
+
+		const uint32_t EXTRA_THREAD_WAIT_TIME = 10;
+
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	struct ThreadPool::ExtraThread
+	{
+		std::unique_ptr<std::thread>		m_thread;
+		std::atomic_bool					m_done = false;
+	};
+
+	//------------------------------------------------------------------------------------------------
+
 	ThreadPool::ThreadPool(
 		Queue*				aWorkQueue,
 		size_t				aNumThreads)
+		: m_workQueue(aWorkQueue)
 	{		
-		if(aNumThreads == 0)
-			aNumThreads = GetCPUCount();
+		Options options;
+		options.m_numThreads = aNumThreads;
+		_Start(options);
+	}
+
+	ThreadPool::ThreadPool(
+		Queue*				aWorkQueue,
+		const Options&		aOptions)
+		: m_workQueue(aWorkQueue)
+	{
+		_Start(aOptions);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		if(!m_stop)
+			Stop(STOP_MODE_IMMEDIATE);
+	}
+
+	void
+	ThreadPool::Stop(
+		StopMode				aStopMode)
+	{
+		assert(!m_stop);
+
+		m_drain = aStopMode == STOP_MODE_DRAIN;
+		m_stop = true;
+
+		if(m_supervisor)
+		{
+			m_supervisorStop.release();
+			m_supervisor->join();
+		}
+
+		// When draining, stop packets come after everything already posted to the worker. Each worker only stops when 
+		// it gets its own, so none are left behind.
+		for(size_t i = 0; i < m_threads.size(); i++)
+		{
+			#if defined(WIN32)
+				if(m_drain)
+					m_workQueue->PostPacket(Queue::MakeStopPacket());
+			#else
+				if(m_drain)
+					m_workQueue->PostPacketToWorker(i, Queue::MakeStopPacket());
+				else
+					m_workQueue->WakeWorker(i);
+			#endif
+		}
+
+		for (std::unique_ptr<std::thread>& t : m_threads)
+		{
+			t->join();
+			t.reset();
+		}
+
+		// Blocking scopes can start extra threads while draining
+		while(true)
+		{
+			std::unique_ptr<ExtraThread> extraThread;
+
+			{
+				std::lock_guard lock(m_extraThreadsLock);
+				if(m_extraThreads.empty())
+					break;
 
-		for (size_t i = 0; i < aNumThreads; i++)
+				extraThread = std::move(m_extraThreads.back());
+				m_extraThreads.pop_back();
+			}
+
+			extraThread->m_thread->join();
+		}
+	}
+
+	ThreadPool*
+	ThreadPool::GetCurrent()
+	{
+		return t_currentThreadPool;
+	}
+
+	void
+	ThreadPool::PostToWorker(
+		size_t					aWorkerIndex,
+		std::function<void()>	aFunction)
+	{
+		assert(aWorkerIndex < m_threads.size());
+
+		m_workQueue->PostFunctionToWorker(aWorkerIndex, std::move(aFunction));
+	}
+
+	void
+	ThreadPool::PostToWorkerWithGroup(
+		size_t					aWorkerIndex,
+		Group*					aGroup,
+		std::function<void()>	aFunction)
+	{
+		assert(aWorkerIndex < m_threads.size());
+
+		m_workQueue->PostFunctionToWorkerWithGroup(aWorkerIndex, aGroup, std::move(aFunction));
+	}
+
+	void
+	ThreadPool::Broadcast(
+		std::function<void()>	aFunction)
+	{
+		// Helps while waiting, in case it's called from one of the workers
+		Group group(Group::FLAG_FIXED_SIZE, (uint32_t)m_threads.size());
+		BroadcastWithGroup(&group, std::move(aFunction));
+		group.WaitAndHelp(m_workQueue);
+	}
+
+	void
+	ThreadPool::BroadcastWithGroup(
+		Group*					aGroup,
+		std::function<void()>	aFunction)
+	{
+		for(size_t i = 0; i < m_threads.size(); i++)
+			m_workQueue->PostFunctionToWorkerWithGroup(i, aGroup, aFunction);
+	}
+
+	void
+	ThreadPool::BeginBlocking()
+	{
+		size_t blockedThreadCount = ++m_blockedThreadCount;
+
+		{
+			// Idle extra threads stop under the same lock, so one can't stop after we've counted on it
+			std::lock_guard lock(m_extraThreadsLock);
+
+			if(m_extraThreadCount >= blockedThreadCount || blockedThreadCount > m_options.m_maxBlockingThreads)
+				return;
+
+			m_extraThreadCount++;
+		}
+
+		// Count it as growth, so the new thread doesn't stop right away if the blocking call returns quickly
+		m_lastGrowTime = std::chrono::steady_clock::now();
+		_StartExtraThread();
+	}
+
+	void
+	ThreadPool::EndBlocking()
+	{
+		assert(m_blockedThreadCount > 0);
+		m_blockedThreadCount--;
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	void
+	ThreadPool::_Start(
+		const Options&		aOptions)
+	{
+		m_options = aOptions;
+
+		size_t numThreads = aOptions.m_numThreads;
+
+		// Group usable CPUs by physical core
+		std::vector<std::vector<Topology::CPU>> cores;
+		size_t usableCPUCount = 0;
+
+		if(aOptions.m_affinity != AFFINITY_NONE || aOptions.m_skipSMTSiblings || aOptions.m_reservedCores > 0 || !aOptions.m_cpus.empty())
 		{
-			std::unique_ptr<std::thread> t = std::make_unique<std::thread>([&, aWorkQueue]()
+			Topology topology = Topology::Detect();
+			const Topology::CPU* previous = NULL;
+
+			for(const Topology::CPU& cpu : topology.GetCPUs())
 			{
-				while (!m_stop)
-					aWorkQueue->WaitAndExecute(100);
+				if(!aOptions.m_cpus.empty() && std::find(aOptions.m_cpus.begin(), aOptions.m_cpus.end(), cpu.m_id) == aOptions.m_cpus.end())
+					continue;
+
+				if(previous == NULL || !cpu.IsSameCore(*previous))
+					cores.push_back({ cpu });
+				else if(!aOptions.m_skipSMTSiblings)
+					cores.back().push_back(cpu);
+
+				previous = &cpu;
+			}
+
+			// Never reserve everything
+			size_t reservedCores = std::min(aOptions.m_reservedCores, cores.size() > 0 ? cores.size() - 1 : 0);
+			cores.erase(cores.begin(), cores.begin() + reservedCores);
+
+			for(const std::vector<Topology::CPU>& core : cores)
+				usableCPUCount += core.size();
+
+			// No point in having more threads than the CPU quota allows to run at the same time
+			if(topology.GetCPUQuota() > 0.0)
+				usableCPUCount = std::min(usableCPUCount, topology.GetUsableCPUCount());
+		}
+
+		if(numThreads == 0)
+			numThreads = cores.empty() ? GetCPUCount() : std::max<size_t>(usableCPUCount, 1);
+
+		// CPUs each thread is allowed to run on, empty if not restricted
+		std::vector<std::vector<uint32_t>> threadCPUs(numThreads);
+
+		if(!cores.empty())
+		{
+			std::vector<uint32_t> allCPUs;
+			std::vector<std::vector<uint32_t>> coreCPUs;
+			std::vector<std::vector<uint32_t>> l3CPUs;
+			std::vector<uint32_t> l3Ids;
+
+			for(const std::vector<Topology::CPU>& core : cores)
+			{
+				coreCPUs.push_back({});
+
+				for(const Topology::CPU& cpu : core)
+				{
+					allCPUs.push_back(cpu.m_id);
+					coreCPUs.back().push_back(cpu.m_id);
+
+					size_t l3Index = std::find(l3Ids.begin(), l3Ids.end(), cpu.m_l3Id) - l3Ids.begin();
+					if(l3Index == l3Ids.size())
+					{
+						l3Ids.push_back(cpu.m_l3Id);
+						l3CPUs.push_back({});
+					}
+
+					l3CPUs[l3Index].push_back(cpu.m_id);
+				}
+			}
+
+			for(size_t i = 0; i < numThreads; i++)
+			{
+				switch(aOptions.m_affinity)
+				{
+				case AFFINITY_L3:		threadCPUs[i] = l3CPUs[i % l3CPUs.size()]; break;
+				case AFFINITY_CORE:		threadCPUs[i] = coreCPUs[i % coreCPUs.size()]; break;
+				case AFFINITY_CPU:		threadCPUs[i] = { allCPUs[i % allCPUs.size()] }; break;
+				default:				threadCPUs[i] = allCPUs; break;
+				}
+			}
+
+			m_extraThreadCPUs = allCPUs;
+		}
+
+		// Each thread gets its own worker-local queue
+		m_workQueue->SetWakePolicy(aOptions.m_wakePolicy);
+
+		if(aOptions.m_spinBudget.count() > 0)
+			m_workQueue->SetSpinBudget(aOptions.m_spinBudget);
+		m_workQueue->SetWorkerCount(std::max(m_workQueue->GetWorkerCount(), numThreads));
+
+		for (size_t i = 0; i < numThreads; i++)
+		{
+			std::unique_ptr<std::thread> t = std::make_unique<std::thread>([&, cpus = std::move(threadCPUs[i]), i]()
+			{
+				if(!cpus.empty())
+				{
+					bool ok = Topology::SetCurrentThreadAffinity(cpus);
+					(void)ok;
+					assert(ok);
+				}
+
+				t_currentThreadPool = this;
+				m_workQueue->AttachWorker(i);
+
+				while(true)
+				{
+					if(m_workQueue->WaitAndExecute(WORKER_WAIT_TIME) == Queue::WAIT_RESULT_STOPPED)
+					{
+						if(m_drain)
+							_Drain();
+
+						break;
+					}
+
+					if(m_stop && !m_drain)
+						break;
+				}
+
+				m_workQueue->DetachWorker();
 			});
 
 			m_threads.push_back(std::move(t));
 		}
+
+		if(aOptions.m_maxThreads > numThreads)
+			m_supervisor = std::make_unique<std::thread>([this]() { _RunSupervisor(); });
 	}
 
-	ThreadPool::~ThreadPool()
+	void
+	ThreadPool::_StartExtraThread()
 	{
-		m_stop = true;
+		// Already counted by the caller
+		std::unique_ptr<ExtraThread> extraThread = std::make_unique<ExtraThread>();
+		ExtraThread* p = extraThread.get();
+
+		_JoinStoppedExtraThreads();
 
-		for (std::unique_ptr<std::thread>& t : m_threads)
 		{
-			t->join();
-			t.reset();
+			std::lock_guard lock(m_extraThreadsLock);
+			m_extraThreads.push_back(std::move(extraThread));
+			p->m_thread = std::make_unique<std::thread>([this, p]() { _RunExtraThread(p); });
+		}
+	}
+
+	void
+	ThreadPool::_JoinStoppedExtraThreads()
+	{
+		std::lock_guard lock(m_extraThreadsLock);
+
+		for(size_t i = 0; i < m_extraThreads.size(); )
+		{
+			if(m_extraThreads[i]->m_done)
+			{
+				m_extraThreads[i]->m_thread->join();
+				m_extraThreads[i] = std::move(m_extraThreads.back());
+				m_extraThreads.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	void
+	ThreadPool::_RunExtraThread(
+		ExtraThread*			aExtraThread)
+	{
+		if(!m_extraThreadCPUs.empty())
+			Topology::SetCurrentThreadAffinity(m_extraThreadCPUs);
+
+		t_currentThreadPool = this;
+
+		std::chrono::steady_clock::time_point lastActiveTime = std::chrono::steady_clock::now();
+		uint32_t waitTime = (uint32_t)std::min<int64_t>(m_options.m_idleTimeout.count(), EXTRA_THREAD_WAIT_TIME);
+
+		while(true)
+		{
+			if(m_stop)
+			{
+				if(m_drain)
+					_Drain();
+
+				m_extraThreadCount--;
+				break;
+			}
+
+			if(m_workQueue->WaitAndExecute(waitTime) == Queue::WAIT_RESULT_OK)
+			{
+				lastActiveTime = std::chrono::steady_clock::now();
+				continue;
+			}
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if(now - lastActiveTime < m_options.m_idleTimeout || now - m_lastGrowTime.load() < m_options.m_idleTimeout)
+				continue;
+
+			// Still needed while threads are blocked
+			std::lock_guard lock(m_extraThreadsLock);
+
+			if(m_extraThreadCount > m_blockedThreadCount)
+			{
+				m_extraThreadCount--;
+				break;
+			}
+		}
+
+		aExtraThread->m_done = true;
+	}
+
+	void
+	ThreadPool::_RunSupervisor()
+	{
+		// Measures how long a sample packet, the last one posted before sampling, waits in the queue. Packets are 
+		// dequeued roughly in order, so it has been dequeued when as many packets have been dequeued as were posted 
+		// before it.
+		bool sampling = false;
+		uint64_t samplePostedCount = 0;
+		std::chrono::steady_clock::time_point sampleTime;
+
+		while(!m_supervisorStop.try_acquire_for(m_options.m_supervisorInterval))
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+			_JoinStoppedExtraThreads();
+
+			size_t queuedCount = m_workQueue->GetQueuedPacketCount();
+			uint64_t postedCount = m_workQueue->GetPostedPacketCount();
+			uint64_t dequeuedCount = postedCount - std::min<uint64_t>(queuedCount, postedCount);
+
+			if(sampling && dequeuedCount >= samplePostedCount)
+				sampling = false;
+
+			if(!sampling && queuedCount > 0)
+			{
+				sampling = true;
+				samplePostedCount = postedCount;
+				sampleTime = now;
+			}
+
+			bool backedUp = queuedCount > m_options.m_growQueueLength || (sampling && now - sampleTime > m_options.m_growQueueAge);
+
+			if(backedUp && m_threads.size() + m_extraThreadCount < m_options.m_maxThreads)
+			{
+				m_lastGrowTime = now;
+				m_extraThreadCount++;
+				_StartExtraThread();
+			}
+		}
+	}
+
+	void
+	ThreadPool::_Drain()
+	{
+		while(true)
+		{
+			Queue::WaitResult result = m_workQueue->WaitAndExecute(0);
+
+			// Stop packet of another thread, everything posted before it has been taken already. Not possible with 
+			// worker inboxes.
+			#if defined(WIN32)
+				if(result == Queue::WAIT_RESULT_STOPPED)
+				{
+					m_workQueue->PostPacket(Queue::MakeStopPacket());
+					break;
+				}
+			#endif
+
+			if(result == Queue::WAIT_RESULT_ERROR)
+				break;
+
+			// Timing out can also mean that a packet was taken by another thread, or that we were woken up for nothing
+			if(result == Queue::WAIT_RESULT_TIMED_OUT && m_workQueue->GetQueuedPacketCount() == 0 && m_workQueue->GetLocalPacketCount() == 0)
+				break;
 		}
 	}
 
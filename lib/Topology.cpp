@@ -0,0 +1,422 @@
+#include "Pcheader.h"
+
+#include <nwork/Topology.h>
+
+namespace nwork
+{
+
+	namespace
+	{
+
+		#if !defined(WIN32)
+			bool
+			_ReadUInt32FromFile(
+				const char*						aPath,
+				uint32_t&						aOut)
+			{
+				FILE* f = fopen(aPath, "r");
+				if(f == NULL)
+					return false;
+
+				bool ok = fscanf(f, "%u", &aOut) == 1;
+				fclose(f);
+				return ok;
+			}
+
+			uint32_t
+			_ReadNodeId(
+				uint32_t						aCPUId)
+			{
+				// CPU directory has a "nodeN" link to the node it belongs to
+				char path[256];
+				snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", aCPUId);
+
+				DIR* dir = opendir(path);
+				if(dir == NULL)
+					return 0;
+
+				uint32_t nodeId = 0;
+
+				while(struct dirent* entry = readdir(dir))
+				{
+					if(sscanf(entry->d_name, "node%u", &nodeId) == 1)
+						break;
+				}
+
+				closedir(dir);
+				return nodeId;
+			}
+
+			uint32_t
+			_ReadL3Id(
+				uint32_t						aCPUId,
+				uint32_t						aDefault)
+			{
+				char path[256];
+
+				for(uint32_t i = 0; ; i++)
+				{
+					uint32_t level = 0;
+					snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", aCPUId, i);
+					if(!_ReadUInt32FromFile(path, level))
+						return aDefault;
+
+					if(level != 3)
+						continue;
+
+					// Older kernels don't have cache ids, lowest CPU sharing the cache identifies it just as well
+					uint32_t id = 0;
+					snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/id", aCPUId, i);
+					if(_ReadUInt32FromFile(path, id))
+						return id;
+
+					snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", aCPUId, i);
+					if(_ReadUInt32FromFile(path, id))
+						return id;
+
+					return aDefault;
+				}
+			}
+
+			double
+			_ReadCGroupCPUQuota()
+			{
+				double quota = 0.0;
+
+				// cgroup v2, every cgroup up to the root can have a limit
+				char cgroupPath[1024] = { 0 };
+
+				if(FILE* f = fopen("/proc/self/cgroup", "r"))
+				{
+					char line[1024];
+					while(fgets(line, sizeof(line), f) != NULL)
+					{
+						if(strncmp(line, "0::", 3) == 0)
+						{
+							snprintf(cgroupPath, sizeof(cgroupPath), "%s", line + 3);
+							cgroupPath[strcspn(cgroupPath, "\n")] = '\0';
+							break;
+						}
+					}
+
+					fclose(f);
+				}
+
+				while(cgroupPath[0] == '/')
+				{
+					char path[1280];
+					snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", cgroupPath);
+
+					if(FILE* f = fopen(path, "r"))
+					{
+						char max[32];
+						unsigned long period = 0;
+						if(fscanf(f, "%31s %lu", max, &period) == 2 && strcmp(max, "max") != 0 && period > 0)
+						{
+							double cgroupQuota = strtod(max, NULL) / (double)period;
+							if(cgroupQuota > 0.0 && (quota == 0.0 || cgroupQuota < quota))
+								quota = cgroupQuota;
+						}
+
+						fclose(f);
+					}
+
+					char* separator = strrchr(cgroupPath, '/');
+					if(separator == cgroupPath)
+						break;
+
+					*separator = '\0';
+				}
+
+				if(quota > 0.0)
+					return quota;
+
+				// cgroup v1
+				uint32_t v1Quota = 0;
+				uint32_t v1Period = 0;
+				if(_ReadUInt32FromFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", v1Quota) 
+					&& _ReadUInt32FromFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us", v1Period) && v1Period > 0)
+				{
+					// Unlimited is -1, which doesn't make it through %u
+					if(v1Quota > 0 && v1Quota < INT32_MAX)
+						quota = (double)v1Quota / (double)v1Period;
+				}
+
+				return quota;
+			}
+		#endif
+
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	Topology
+	Topology::Detect()
+	{
+		Topology topology;
+
+		#if defined(WIN32)
+			DWORD_PTR processMask = 0;
+			DWORD_PTR systemMask = 0;
+			if(!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+				processMask = 0;
+
+			DWORD size = 0;
+			GetLogicalProcessorInformation(NULL, &size);
+			std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+			if(infos.empty() || !GetLogicalProcessorInformation(&infos[0], &size))
+				infos.clear();
+
+			uint32_t coreId = 0;
+
+			for(const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info : infos)
+			{
+				if(info.Relationship != RelationProcessorCore)
+					continue;
+
+				for(uint32_t i = 0; i < sizeof(ULONG_PTR) * 8; i++)
+				{
+					ULONG_PTR bit = (ULONG_PTR)1 << i;
+					if((info.ProcessorMask & bit) != 0 && (processMask & bit) != 0)
+					{
+						CPU cpu;
+						cpu.m_id = i;
+						cpu.m_coreId = coreId;
+
+						UCHAR nodeId = 0;
+						if(GetNumaProcessorNode((UCHAR)i, &nodeId))
+							cpu.m_nodeId = nodeId;
+
+						topology.AddCPU(cpu);
+					}
+				}
+
+				coreId++;
+			}
+
+			uint32_t l3Id = 0;
+
+			for(const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info : infos)
+			{
+				if(info.Relationship != RelationCache || info.Cache.Level != 3)
+					continue;
+
+				for(CPU& cpu : topology.m_cpus)
+				{
+					if((info.ProcessorMask & ((ULONG_PTR)1 << cpu.m_id)) != 0)
+						cpu.m_l3Id = l3Id;
+				}
+
+				l3Id++;
+			}
+		#else
+			// Mask of the main thread, which is the one the process was started with. The calling thread might be a 
+			// pinned worker.
+			cpu_set_t cpuSet;
+			CPU_ZERO(&cpuSet);
+			if(sched_getaffinity(getpid(), sizeof(cpuSet), &cpuSet) != 0)
+				return topology;
+
+			for(uint32_t i = 0; i < CPU_SETSIZE; i++)
+			{
+				if(!CPU_ISSET(i, &cpuSet))
+					continue;
+
+				CPU cpu;
+				cpu.m_id = i;
+
+				// Without topology information every logical CPU is its own core
+				char path[256];
+				snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/core_id", i);
+				if(!_ReadUInt32FromFile(path, cpu.m_coreId))
+					cpu.m_coreId = i;
+
+				snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", i);
+				if(!_ReadUInt32FromFile(path, cpu.m_packageId))
+					cpu.m_packageId = 0;
+
+				cpu.m_nodeId = _ReadNodeId(i);
+				cpu.m_l3Id = _ReadL3Id(i, cpu.m_packageId);
+
+				topology.AddCPU(cpu);
+			}
+
+			topology.m_cpuQuota = _ReadCGroupCPUQuota();
+		#endif
+
+		return topology;
+	}
+
+	Topology
+	Topology::Simulate(
+		uint32_t							aNodeCount,
+		uint32_t							aCoresPerNode,
+		uint32_t							aThreadsPerCore)
+	{
+		Topology topology;
+		topology.m_simulated = true;
+
+		uint32_t id = 0;
+
+		for(uint32_t i = 0; i < aNodeCount; i++)
+		{
+			for(uint32_t j = 0; j < aCoresPerNode; j++)
+			{
+				for(uint32_t k = 0; k < aThreadsPerCore; k++)
+				{
+					CPU cpu;
+					cpu.m_id = id++;
+					cpu.m_coreId = j;
+					cpu.m_packageId = i;
+					cpu.m_nodeId = i;
+					cpu.m_l3Id = i;
+					topology.AddCPU(cpu);
+				}
+			}
+		}
+
+		return topology;
+	}
+
+	bool
+	Topology::SetCurrentThreadAffinity(
+		const std::vector<uint32_t>&		aCPUIds)
+	{
+		assert(!aCPUIds.empty());
+
+		#if defined(WIN32)
+			DWORD_PTR mask = 0;
+			for(uint32_t cpuId : aCPUIds)
+			{
+				assert(cpuId < sizeof(DWORD_PTR) * 8);
+				mask |= (DWORD_PTR)1 << cpuId;
+			}
+
+			return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+		#else
+			cpu_set_t cpuSet;
+			CPU_ZERO(&cpuSet);
+			for(uint32_t cpuId : aCPUIds)
+			{
+				assert(cpuId < CPU_SETSIZE);
+				CPU_SET(cpuId, &cpuSet);
+			}
+
+			return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+		#endif
+	}
+
+	void
+	Topology::AddCPU(
+		const CPU&							aCPU)
+	{
+		std::vector<CPU>::iterator i = std::upper_bound(m_cpus.begin(), m_cpus.end(), aCPU, [](
+			const CPU&	aLHS,
+			const CPU&	aRHS)
+		{
+			if(aLHS.m_packageId != aRHS.m_packageId)
+				return aLHS.m_packageId < aRHS.m_packageId;
+			if(aLHS.m_coreId != aRHS.m_coreId)
+				return aLHS.m_coreId < aRHS.m_coreId;
+			return aLHS.m_id < aRHS.m_id;
+		});
+
+		m_cpus.insert(i, aCPU);
+	}
+
+	std::vector<uint32_t>
+	Topology::GetNodeIds() const
+	{
+		std::vector<uint32_t> nodeIds;
+
+		for(const CPU& cpu : m_cpus)
+		{
+			std::vector<uint32_t>::iterator i = std::lower_bound(nodeIds.begin(), nodeIds.end(), cpu.m_nodeId);
+			if(i == nodeIds.end() || *i != cpu.m_nodeId)
+				nodeIds.insert(i, cpu.m_nodeId);
+		}
+
+		return nodeIds;
+	}
+
+	std::vector<uint32_t>
+	Topology::GetCPUIdsOfNode(
+		uint32_t							aNodeId) const
+	{
+		std::vector<uint32_t> cpuIds;
+
+		for(const CPU& cpu : m_cpus)
+		{
+			if(cpu.m_nodeId == aNodeId)
+				cpuIds.push_back(cpu.m_id);
+		}
+
+		return cpuIds;
+	}
+
+	std::vector<uint32_t>
+	Topology::GetL3Ids() const
+	{
+		std::vector<uint32_t> l3Ids;
+
+		for(const CPU& cpu : m_cpus)
+		{
+			std::vector<uint32_t>::iterator i = std::lower_bound(l3Ids.begin(), l3Ids.end(), cpu.m_l3Id);
+			if(i == l3Ids.end() || *i != cpu.m_l3Id)
+				l3Ids.insert(i, cpu.m_l3Id);
+		}
+
+		return l3Ids;
+	}
+
+	std::vector<uint32_t>
+	Topology::GetCPUIdsOfL3(
+		uint32_t							aL3Id) const
+	{
+		std::vector<uint32_t> cpuIds;
+
+		for(const CPU& cpu : m_cpus)
+		{
+			if(cpu.m_l3Id == aL3Id)
+				cpuIds.push_back(cpu.m_id);
+		}
+
+		return cpuIds;
+	}
+
+	size_t
+	Topology::GetPhysicalCoreCount() const
+	{
+		size_t count = 0;
+
+		for(size_t i = 0; i < m_cpus.size(); i++)
+		{
+			if(i == 0 || !m_cpus[i].IsSameCore(m_cpus[i - 1]))
+				count++;
+		}
+
+		return count;
+	}
+
+	size_t
+	Topology::GetUsableCPUCount() const
+	{
+		size_t count = m_cpus.size();
+
+		if(m_cpuQuota > 0.0)
+			count = std::min(count, (size_t)ceil(m_cpuQuota));
+
+		return std::max<size_t>(count, 1);
+	}
+
+	//------------------------------------------------------------------------------------------------
+
+	size_t
+	GetCPUCount()
+	{
+		static const size_t CPU_COUNT = Topology::Detect().GetUsableCPUCount();
+
+		return CPU_COUNT;
+	}
+
+}
\ No newline at end of file
@@ -3,6 +3,11 @@
 #include <random>
 #include <unordered_set>
 
+#if !defined(WIN32)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
 #include <nwork/API.h>
 
 namespace nwork_test
@@ -300,93 +305,1647 @@ namespace nwork_test
 
 				assert(f);
 			}
-		}
 
-		void
-		_TestReferences()
-		{
-			struct TestObject
+			// Sharded, both small and large enough to require flushing shards
+			for(uint32_t count : { 1, 10, 1000, 100000 })
 			{
-				void
-				AddReference()
+				std::atomic_uint32_t x = 0;
+
 				{
-					m_refCount++;
+					nwork::Group group(nwork::Group::FLAG_SHARDED);
+
+					for(uint32_t i = 0; i < count; i++)
+						aWorkQueue->PostFunctionWithGroup(&group, [&]() { x++; });
+
+					group.Wait();
+					assert(x == count);
 				}
 
-				void
-				RemoveReference()
 				{
-					if(--m_refCount == 0)
+					nwork::Group group(nwork::Group::FLAG_SHARDED | nwork::Group::FLAG_FIXED_SIZE, count);
+
+					for(uint32_t i = 0; i < count; i++)
+						aWorkQueue->PostFunctionWithGroup(&group, [&]() { x++; });
+
+					group.Wait();
+					assert(x == count * 2);
+				}
+
+				{
+					std::binary_semaphore allCompleted(0);
+
 					{
-						assert(!m_deleted);
-						m_deleted = true;
+						nwork::Reference<nwork::Group> group(nwork::Group::NewReferenceCounted(nwork::Group::FLAG_SHARDED));
+
+						group->SetCompletionFunction([&]()
+						{
+							assert(x == count * 3);
+							allCompleted.release();
+						});
+
+						for(uint32_t i = 0; i < count; i++)
+							aWorkQueue->PostFunctionWithGroup(group, [&]() { x++; });
+
+						group->OnAllPosted();
 					}
+
+					allCompleted.acquire();
 				}
+			}
 
-				uint32_t				m_refCount = 0;
-				bool					m_deleted = false;
-			};
+			// Timed wait
+			{
+				std::binary_semaphore block(0);
+				nwork::Group group;
+
+				aWorkQueue->PostFunctionWithGroup(&group, [&]() { block.acquire(); });
+
+				bool completed = group.WaitFor(std::chrono::milliseconds(10));
+				assert(!completed);
+
+				block.release();
+				completed = group.WaitFor(std::chrono::seconds(10));
+				assert(completed);
+			}
 
+			// Wait and help, both from this thread and from workers
 			{
-				TestObject x;
+				std::atomic_uint32_t x = 0;
+				nwork::Group group;
 
+				for(uint32_t i = 0; i < 100; i++)
 				{
-					nwork::Reference<TestObject> p(&x);
-					assert(!x.m_deleted);
-					assert(x.m_refCount == 1);
+					aWorkQueue->PostFunctionWithGroup(&group, [&]()
+					{
+						nwork::Group nestedGroup;
+
+						for(uint32_t j = 0; j < 10; j++)
+							aWorkQueue->PostFunctionWithGroup(&nestedGroup, [&]() { x++; });
+
+						nestedGroup.WaitAndHelp(aWorkQueue);
+					});
 				}
 
-				assert(x.m_deleted);
+				group.WaitAndHelp(aWorkQueue);
+				assert(x == 1000);
 			}
 
+			// Child groups and tasks added from inside tasks after everything has been posted
 			{
-				TestObject x;
+				std::atomic_uint32_t x = 0;
+				std::atomic_uint32_t childrenCompleted = 0;
+				nwork::Group frameGroup;
 
+				for(uint32_t i = 0; i < 10; i++)
 				{
-					nwork::Reference<TestObject> p(&x);
-					assert(!x.m_deleted);
-					assert(x.m_refCount == 1);
+					nwork::Group* childGroup = nwork::Group::NewReferenceCounted(i % 2 == 0 ? nwork::Group::FLAG_SHARDED : 0);
+					childGroup->AddReference();
+					childGroup->SetParent(&frameGroup);
+					childGroup->SetCompletionFunction([&]()
+					{
+						assert(x >= 100);
+						childrenCompleted++;
+					});
 
-					nwork::Reference<TestObject> a = p;
-					assert(!x.m_deleted);
-					assert(x.m_refCount == 2);
+					for(uint32_t j = 0; j < 10; j++)
+					{
+						aWorkQueue->PostFunctionWithGroup(childGroup, [&, childGroup]()
+						{
+							for(uint32_t k = 0; k < 10; k++)
+								aWorkQueue->PostFunctionWithGroup(childGroup, [&]() { x++; });
+						});
+					}
 
-					assert(a == p);
-					a.Release();
+					childGroup->OnAllPosted();
+					childGroup->RemoveReference();
+				}
 
-					assert(!x.m_deleted);
-					assert(x.m_refCount == 1);
+				frameGroup.Wait();
+				assert(x == 1000);
+				assert(childrenCompleted == 10);
+			}
 
-					assert(a.IsNull());
-					assert(!p.IsNull());
+			// Cancellation
+			{
+				std::atomic_uint32_t x = 0;
+				std::atomic_bool running = false;
+				nwork::Group frameGroup;
+				nwork::Group childGroup;
+				childGroup.SetParent(&frameGroup);
 
-					nwork::Reference<TestObject> b = std::move(p);
-					assert(!x.m_deleted);
-					assert(x.m_refCount == 1);
+				nwork::CancellationToken token(&childGroup);
 
-					assert(!b.IsNull());
-					assert(p.IsNull());
+				aWorkQueue->PostFunctionWithGroup(&childGroup, [&]()
+				{
+					running = true;
+
+					while(!token.IsCancelled())
+						std::this_thread::yield();
+
+					x++;
+				});
+
+				while(!running)
+					std::this_thread::yield();
+
+				frameGroup.Cancel();
+				assert(childGroup.IsCancelled());
+
+				for(uint32_t i = 0; i < 100; i++)
+					aWorkQueue->PostFunctionWithGroup(&childGroup, [&]() { x++; });
+
+				childGroup.OnAllPosted();
+				frameGroup.Wait();
+				assert(x == 1);
+			}
+
+			// Pooled
+			{
+				std::atomic_uint32_t x = 0;
+				std::atomic_uint32_t completed = 0;
+
+				for(uint32_t i = 0; i < 1000; i++)
+				{
+					nwork::Group* pooledGroup = nwork::Group::NewPooled(i % 3 == 0 ? nwork::Group::FLAG_SHARDED : 0);
+					nwork::Reference<nwork::Group> group(pooledGroup);
+
+					assert(!group->IsCancelled());
+					group->SetCompletionFunction([&]() { completed++; });
+
+					for(uint32_t j = 0; j < 10; j++)
+					{
+						aWorkQueue->PostFunctionWithGroup(group, [&, pooledGroup]()
+						{
+							// Pooled groups posted from workers end up in their local pools
+							x++;
+							nwork::Reference<nwork::Group> nestedGroup(nwork::Group::NewPooled(nwork::Group::FLAG_FIXED_SIZE, 1));
+							nestedGroup->SetParent(pooledGroup);
+							aWorkQueue->PostFunctionWithGroup(nestedGroup, [&]() { x++; });
+						});
+					}
+
+					group->Wait();
 				}
 
-				assert(x.m_deleted);
+				assert(x == 20000);
+				assert(completed == 1000);
+			}
+
+			// Pooled, released by the main thread
+			{
+				std::atomic_uint32_t x = 0;
+				nwork::Group* pooledGroup = nwork::Group::NewPooled(nwork::Group::FLAG_FIXED_SIZE, 10);
+
+				{
+					nwork::Reference<nwork::Group> group(pooledGroup);
+
+					// Tasks don't hold references, so the last one is released here and the group goes to this thread's pool
+					for(uint32_t i = 0; i < 10; i++)
+						aWorkQueue->PostFunction([&, pooledGroup]() { x++; pooledGroup->OnCompletion(); });
+
+					group->Wait();
+				}
+
+				nwork::Reference<nwork::Group> reusedGroup(nwork::Group::NewPooled());
+				assert(reusedGroup == pooledGroup);
+				assert(!reusedGroup->IsFixedSize());
+				assert(x == 10);
 			}
 
+			// Batch of functions
+			{
+				std::atomic_uint32_t x = 0;
+				std::vector<std::function<void()>> functions(1000, [&]() { x++; });
+
+				{
+					nwork::Group group;
+					aWorkQueue->PostFunctionsWithGroup(&group, functions);
+					group.Wait();
+					assert(x == 1000);
+				}
+
+				{
+					nwork::Group group(nwork::Group::FLAG_FIXED_SIZE, (uint32_t)functions.size());
+					aWorkQueue->PostFunctionsWithGroup(&group, functions);
+					group.Wait();
+					assert(x == 2000);
+				}
+
+				for(uint32_t flags : { 0u, (uint32_t)nwork::Group::FLAG_SHARDED })
+				{
+					nwork::Reference<nwork::Group> group(nwork::Group::NewReferenceCounted(flags));
+					aWorkQueue->PostFunctionsWithGroup(group, functions);
+					aWorkQueue->PostFunctionsWithGroup(group, std::span(functions).subspan(0, 10));
+					group->Wait();
+				}
+
+				assert(x == 4020);
+			}
 		}
-	}
 
-	void
-	Run()
-	{
+		uint64_t
+		_ParallelSum(
+			nwork::Queue*				aWorkQueue,
+			const uint32_t*				aValues,
+			size_t						aCount)
 		{
-			nwork::Queue workQueue;
-			nwork::ThreadPool threadPool(&workQueue, 8);
+			if(aCount <= 64)
+			{
+				uint64_t sum = 0;
+				for(size_t i = 0; i < aCount; i++)
+					sum += aValues[i];
+				return sum;
+			}
 
-			_TestFunctions(&workQueue);
-			_TestObjects(&workQueue);
-			_TestForEach(&workQueue);
-			_TestGroups(&workQueue);
-			_TestReferences();
+			uint64_t sumA = 0;
+			uint64_t sumB = 0;
+
+			aWorkQueue->Invoke(
+				[&]() { sumA = _ParallelSum(aWorkQueue, aValues, aCount / 2); },
+				[&]() { sumB = _ParallelSum(aWorkQueue, aValues + aCount / 2, aCount - aCount / 2); });
+
+			return sumA + sumB;
 		}
+
+		void
+		_TestInvoke(
+			nwork::Queue*				aWorkQueue)
+		{
+			// Single function is executed inline
+			{
+				std::thread::id threadId;
+				aWorkQueue->Invoke([&]() { threadId = std::this_thread::get_id(); });
+				assert(threadId == std::this_thread::get_id());
+			}
+
+			// Multiple functions
+			{
+				std::atomic_uint32_t x = 0;
+				aWorkQueue->Invoke(
+					[&]() { x += 1; },
+					[&]() { x += 2; },
+					[&]() { x += 4; });
+				assert(x == 7);
+			}
+
+			// Recursive divide-and-conquer
+			{
+				std::vector<uint32_t> values;
+				uint64_t expectedSum = 0;
+				for(uint32_t i = 0; i < 10000; i++)
+				{
+					values.push_back(i);
+					expectedSum += i;
+				}
+
+				assert(_ParallelSum(aWorkQueue, &values[0], values.size()) == expectedSum);
+			}
+		}
+
+		void
+		_TestFutures(
+			nwork::Queue*				aWorkQueue)
+		{
+			// Value
+			{
+				nwork::Future<uint32_t> future = aWorkQueue->Async([]() { return 1234U; });
+				assert(future.Get() == 1234);
+				assert(future.IsReady());
+			}
+
+			// Void
+			{
+				std::atomic_bool f = false;
+				nwork::Future<void> future = aWorkQueue->Async([&]() { f = true; });
+				future.Wait();
+				assert(f);
+			}
+
+			// Continuations
+			{
+				nwork::Future<std::string> future = aWorkQueue->Async([]() 
+				{ 
+					return 10U; 
+				}).Then([](
+					uint32_t aValue) 
+				{ 
+					return aValue * 2; 
+				}).Then([](
+					uint32_t aValue) 
+				{ 
+					return std::to_string(aValue); 
+				});
+
+				assert(future.Get() == "20");
+			}
+
+			// Continuation attached after completion
+			{
+				nwork::Future<uint32_t> future = aWorkQueue->Async([]() { return 1U; });
+				future.Wait();
+
+				std::atomic_bool f = false;
+				future.Then([&](
+					uint32_t aValue) 
+				{ 
+					assert(aValue == 1);
+					f = true; 
+				}).Wait();
+
+				assert(f);
+			}
+
+			// Several continuations of a future that hasn't completed yet
+			{
+				nwork::Promise<uint32_t> promise(aWorkQueue);
+				nwork::Future<uint32_t> future = promise.GetFuture();
+
+				std::vector<nwork::Future<uint32_t>> continuations;
+				for(uint32_t i = 0; i < 3; i++)
+					continuations.push_back(future.Then([i](uint32_t aValue) { return aValue + i; }));
+
+				promise.SetValue(10U);
+
+				for(uint32_t i = 0; i < 3; i++)
+					assert(continuations[i].Get() == 10 + i);
+			}
+
+			// Promise
+			{
+				nwork::Promise<uint32_t> promise(aWorkQueue);
+				nwork::Future<uint32_t> future = promise.GetFuture().Then([](
+					uint32_t aValue)
+				{
+					return aValue + 1;
+				});
+
+				std::thread thread([&]()
+				{
+					promise.SetValue(41U);
+				});
+
+				assert(future.Get() == 42);
+				thread.join();
+			}
+
+			// Many
+			{
+				std::vector<nwork::Future<uint32_t>> futures;
+				for(uint32_t i = 0; i < 1000; i++)
+					futures.push_back(aWorkQueue->Async([i]() { return i; }).Then([](uint32_t aValue) { return aValue * 3; }));
+
+				for(uint32_t i = 0; i < 1000; i++)
+					assert(futures[i].Get() == i * 3);
+			}
+		}
+
+		nwork::Task<uint32_t>
+		_TaskChild(
+			nwork::Queue*				aWorkQueue,
+			uint32_t					aValue)
+		{
+			co_await aWorkQueue->Schedule();
+			co_return aValue * 2;
+		}
+
+		nwork::Task<void>
+		_TaskParent(
+			nwork::Queue*				aWorkQueue,
+			std::atomic_uint32_t*		aCompleted)
+		{
+			co_await aWorkQueue->Schedule();
+
+			// Child task
+			uint32_t value = co_await _TaskChild(aWorkQueue, 10);
+			assert(value == 20);
+
+			// Group
+			{
+				nwork::Group group;
+				std::atomic_uint32_t x = 0;
+
+				for(uint32_t i = 0; i < 10; i++)
+					aWorkQueue->PostFunctionWithGroup(&group, [&]() { x++; });
+
+				co_await group;
+				assert(x == 10);
+			}
+
+			// Empty group
+			{
+				nwork::Group group;
+				co_await group;
+			}
+
+			// File descriptor
+			#if !defined(WIN32)
+			{
+				int fds[2];
+				int result = pipe(fds);
+				assert(result == 0);
+
+				aWorkQueue->RegisterFd(fds[0]);
+				aWorkQueue->PostFunction([&]()
+				{
+					ssize_t bytes = write(fds[1], "x", 1);
+					assert(bytes == 1);
+				});
+
+				uint32_t events = co_await aWorkQueue->WaitForFd(fds[0], EPOLLIN);
+				assert(events & EPOLLIN);
+
+				char c = 0;
+				ssize_t bytes = read(fds[0], &c, 1);
+				assert(bytes == 1 && c == 'x');
+
+				aWorkQueue->UnregisterFd(fds[0]);
+				close(fds[0]);
+				close(fds[1]);
+			}
+			#endif
+
+			(*aCompleted)++;
+		}
+
+		nwork::Task<void>
+		_TaskAwaitGroup(
+			nwork::Queue*				aWorkQueue,
+			nwork::Group*				aGroup,
+			std::atomic_bool*			aReleased,
+			std::atomic_uint32_t*		aCompleted)
+		{
+			co_await aWorkQueue->Schedule();
+			co_await *aGroup;
+			assert(*aReleased);
+			(*aCompleted)++;
+		}
+
+		void
+		_TestTasks(
+			nwork::Queue*				aWorkQueue)
+		{
+			{
+				std::atomic_uint32_t completed = 0;
+				_TaskParent(aWorkQueue, &completed).Wait();
+				assert(completed == 1);
+			}
+
+			{
+				assert(_TaskChild(aWorkQueue, 21).Wait() == 42);
+			}
+
+			{
+				std::atomic_uint32_t completed = 0;
+
+				for(uint32_t i = 0; i < 100; i++)
+					_TaskParent(aWorkQueue, &completed).Detach();
+
+				while(completed != 100)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			// Several tasks waiting for the same group
+			{
+				std::binary_semaphore release(0);
+				std::atomic_bool released = false;
+				std::atomic_uint32_t completed = 0;
+
+				nwork::Group group;
+				aWorkQueue->PostFunctionWithGroup(&group, [&]()
+				{
+					release.acquire();
+					released = true;
+				});
+
+				for(uint32_t i = 0; i < 3; i++)
+					_TaskAwaitGroup(aWorkQueue, &group, &released, &completed).Detach();
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				assert(completed == 0);
+
+				release.release();
+
+				while(completed != 3)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+				group.Wait();
+			}
+		}
+
+		void
+		_TestFibers()
+		{
+			// Single worker thread, so blocking waits would deadlock if the fibers didn't suspend
+			nwork::Queue workQueue;
+			nwork::ThreadPool threadPool(&workQueue, 1);
+
+			struct TestObject
+				: public nwork::Object
+			{
+				// nwork::Object implementation
+				void
+				ExecuteWork() override
+				{
+					assert(nwork::Fiber::GetCurrent() != NULL);
+
+					{
+						nwork::Group group;
+						std::atomic_uint32_t x = 0;
+
+						for(uint32_t i = 0; i < 10; i++)
+							m_workQueue->PostFunctionWithGroup(&group, [&]() { x++; });
+
+						group.Wait();
+						assert(x == 10);
+					}
+
+					{
+						nwork::Future<uint32_t> future = m_workQueue->Async([]() { return 1234U; });
+						assert(future.Get() == 1234);
+					}
+				}
+
+				void
+				AfterExecute() override
+				{
+					m_completed->release();
+				}
+
+				// Public data
+				nwork::Queue*					m_workQueue = NULL;
+				std::counting_semaphore<>*		m_completed = NULL;
+			};
+
+			std::counting_semaphore<> completed(0);
+			std::vector<TestObject> testObjects(100);
+
+			for(TestObject& testObject : testObjects)
+			{
+				testObject.m_workQueue = &workQueue;
+				testObject.m_completed = &completed;
+				workQueue.PostObjectAsFiber(&testObject);
+			}
+
+			for(size_t i = 0; i < testObjects.size(); i++)
+				completed.acquire();
+		}
+
+		void
+		_TestTaskGraph(
+			nwork::Queue*				aWorkQueue)
+		{
+			std::atomic_uint32_t counter = 0;
+			uint32_t physics = 0;
+			uint32_t ai = 0;
+			uint32_t visibility = 0;
+			uint32_t replication = 0;
+
+			nwork::TaskGraph taskGraph(aWorkQueue);
+			nwork::TaskGraph::NodeId physicsNode = taskGraph.AddNode([&]() { physics = ++counter; });
+			nwork::TaskGraph::NodeId aiNode = taskGraph.AddNode([&]() { ai = ++counter; });
+			nwork::TaskGraph::NodeId visibilityNode = taskGraph.AddNode([&]() { visibility = ++counter; });
+			nwork::TaskGraph::NodeId replicationNode = taskGraph.AddNode([&]() { replication = ++counter; });
+			taskGraph.AddDependency(aiNode, physicsNode);
+			taskGraph.AddDependency(visibilityNode, physicsNode);
+			taskGraph.AddDependency(replicationNode, aiNode);
+			taskGraph.AddDependency(replicationNode, visibilityNode);
+
+			for(uint32_t i = 0; i < 100; i++)
+			{
+				counter = 0;
+				taskGraph.Run();
+
+				assert(counter == 4);
+				assert(physics == 1);
+				assert(ai > physics && visibility > physics);
+				assert(replication == 4);
+			}
+
+			// Ref-counted group with completion function
+			{
+				std::binary_semaphore allCompleted(0);
+
+				{
+					nwork::Reference<nwork::Group> group(nwork::Group::NewReferenceCounted());
+					group->SetCompletionFunction([&]()
+					{
+						allCompleted.release();
+					});
+
+					counter = 0;
+					taskGraph.Post(group);
+					group->OnAllPosted();
+				}
+
+				allCompleted.acquire();
+				assert(counter == 4);
+				assert(replication == 4);
+			}
+
+			// Fan-out and for-each nodes, replayed
+			{
+				std::vector<uint32_t> items(1000);
+				std::atomic_uint32_t fanOutCounter = 0;
+				uint64_t sum = 0;
+
+				nwork::TaskGraph frameGraph(aWorkQueue);
+
+				std::vector<std::function<void()>> functions;
+				for(uint32_t i = 0; i < 10; i++)
+					functions.push_back([&]() { fanOutCounter++; });
+
+				nwork::TaskGraph::NodeId fanOutNode = frameGraph.AddFanOutNode(functions);
+				nwork::TaskGraph::NodeId forEachNode = frameGraph.AddForEachInRangeNode(0, 999, [&](int32_t aIndex) { items[aIndex] = fanOutCounter; });
+				nwork::TaskGraph::NodeId doubleNode = frameGraph.AddForEachVectorNode<uint32_t>(items, [](uint32_t& aItem) { aItem *= 2; });
+				nwork::TaskGraph::NodeId sumNode = frameGraph.AddNode([&]() { sum = 0; for(uint32_t item : items) sum += item; });
+				frameGraph.AddDependency(forEachNode, fanOutNode);
+				frameGraph.AddDependency(doubleNode, forEachNode);
+				frameGraph.AddDependency(sumNode, doubleNode);
+
+				for(uint32_t i = 1; i <= 10; i++)
+				{
+					frameGraph.Run();
+
+					assert(fanOutCounter == i * 10);
+					assert(sum == i * 10 * 1000 * 2);
+
+					nwork::TaskGraph::NodeTiming fanOutTiming = frameGraph.GetNodeTiming(fanOutNode);
+					nwork::TaskGraph::NodeTiming forEachTiming = frameGraph.GetNodeTiming(forEachNode);
+					nwork::TaskGraph::NodeTiming doubleTiming = frameGraph.GetNodeTiming(doubleNode);
+					nwork::TaskGraph::NodeTiming sumTiming = frameGraph.GetNodeTiming(sumNode);
+					assert(fanOutTiming.m_startTime <= fanOutTiming.m_endTime);
+					assert(fanOutTiming.m_endTime <= forEachTiming.m_startTime);
+					assert(forEachTiming.m_endTime <= doubleTiming.m_startTime);
+					assert(doubleTiming.m_endTime <= sumTiming.m_startTime);
+					assert(sumTiming.m_executionTime.count() >= 0);
+				}
+			}
+		}
+
+		void
+		_TestStrands(
+			nwork::Queue*				aWorkQueue)
+		{
+			nwork::Strand strand(aWorkQueue);
+			std::atomic_bool running = false;
+			uint32_t x = 0;
+			std::vector<uint32_t> order;
+			nwork::Group group;
+
+			// Post from many tasks, plus an ordered sequence from this thread
+			for(uint32_t i = 0; i < 100; i++)
+			{
+				aWorkQueue->PostFunctionWithGroup(&group, [&]()
+				{
+					for(uint32_t j = 0; j < 10; j++)
+					{
+						strand.Post([&]()
+						{
+							assert(!running.exchange(true));
+							x++;
+							running = false;
+						});
+					}
+				});
+
+				strand.Post([&, i]()
+				{
+					assert(strand.IsCurrent());
+					order.push_back(i);
+
+					// Executed inline
+					bool dispatched = false;
+					strand.Dispatch([&]() { dispatched = true; });
+					assert(dispatched);
+				});
+			}
+
+			group.Wait();
+			assert(!strand.IsCurrent());
+
+			while(!strand.IsIdle())
+				std::this_thread::yield();
+
+			assert(x == 1000);
+			assert(order.size() == 100);
+			for(uint32_t i = 0; i < 100; i++)
+				assert(order[i] == i);
+		}
+
+		void
+		_TestMailboxObjects(
+			nwork::Queue*				aWorkQueue)
+		{
+			struct AddMessage
+				: public nwork::MailboxObject::Message
+			{
+				AddMessage(
+					uint32_t			aValue)
+					: m_value(aValue)
+				{
+
+				}
+
+				// Public data
+				uint32_t				m_value;
+			};
+
+			struct Accumulator
+				: public nwork::MailboxObject
+			{
+				Accumulator(
+					nwork::Queue*		aWorkQueue)
+					: MailboxObject(aWorkQueue, 4)
+				{
+
+				}
+
+				// nwork::MailboxObject implementation
+				void
+				OnMessage(
+					Message*			aMessage) override
+				{
+					assert(IsCurrent());
+					assert(!m_processing.exchange(true));
+					m_sum += ((AddMessage*)aMessage)->m_value;
+					m_count++;
+					m_processing = false;
+				}
+
+				// Public data
+				std::atomic_bool		m_processing = false;
+				uint64_t				m_sum = 0;
+				uint32_t				m_count = 0;
+			};
+
+			Accumulator accumulator(aWorkQueue);
+			nwork::Group group;
+
+			for(uint32_t i = 0; i < 100; i++)
+			{
+				aWorkQueue->PostFunctionWithGroup(&group, [&, i]()
+				{
+					for(uint32_t j = 0; j < 10; j++)
+						accumulator.Send(new AddMessage(i * 10 + j));
+				});
+			}
+
+			group.Wait();
+
+			while(!accumulator.IsIdle())
+				std::this_thread::yield();
+
+			assert(!accumulator.IsCurrent());
+			assert(accumulator.m_count == 1000);
+			assert(accumulator.m_sum == 999 * 1000 / 2);
+		}
+
+		void
+		_TestAffinity(
+			nwork::Queue*				aWorkQueue)
+		{
+			assert(aWorkQueue->GetWorkerCount() == 8);
+
+			// Without stealing, everything with the same key is executed by the same worker
+			{
+				aWorkQueue->SetStealThreshold(SIZE_MAX - 1);
+
+				std::mutex threadIdsLock;
+				std::vector<std::unordered_set<std::thread::id>> threadIds(16);
+				std::counting_semaphore<> done(0);
+
+				for(uint32_t i = 0; i < 1000; i++)
+				{
+					aWorkQueue->PostWithAffinity(i % 16, [&, i]()
+					{
+						{
+							std::lock_guard lock(threadIdsLock);
+							threadIds[i % 16].insert(std::this_thread::get_id());
+						}
+
+						done.release();
+					});
+				}
+
+				for(uint32_t i = 0; i < 1000; i++)
+					done.acquire();
+
+				for(const std::unordered_set<std::thread::id>& keyThreadIds : threadIds)
+					assert(keyThreadIds.size() == 1);
+			}
+
+			// Aligned keys, like pointers, are spread over the workers
+			{
+				std::mutex threadIdsLock;
+				std::unordered_set<std::thread::id> threadIds;
+				std::counting_semaphore<> done(0);
+
+				for(uint64_t i = 0; i < 64; i++)
+				{
+					aWorkQueue->PostWithAffinity(i * 64, [&]()
+					{
+						{
+							std::lock_guard lock(threadIdsLock);
+							threadIds.insert(std::this_thread::get_id());
+						}
+
+						done.release();
+					});
+				}
+
+				for(uint32_t i = 0; i < 64; i++)
+					done.acquire();
+
+				assert(threadIds.size() >= 4);
+			}
+
+			// Work queued for a busy worker gets stolen
+			{
+				aWorkQueue->SetStealThreshold(2);
+
+				std::binary_semaphore blocked(0);
+				std::binary_semaphore unblock(0);
+				std::counting_semaphore<> done(0);
+
+				aWorkQueue->PostWithAffinity(0, [&]()
+				{
+					blocked.release();
+					unblock.acquire();
+				});
+
+				blocked.acquire();
+
+				for(uint32_t i = 0; i < 100; i++)
+					aWorkQueue->PostWithAffinity(0, [&]() { done.release(); });
+
+				// Only up to the threshold can be left behind for the blocked worker
+				for(uint32_t i = 0; i < 98; i++)
+					done.acquire();
+
+				unblock.release();
+
+				for(uint32_t i = 0; i < 2; i++)
+					done.acquire();
+			}
+
+			aWorkQueue->SetStealThreshold(4);
+
+			// Even a single packet is stolen when its worker stays busy
+			{
+				std::binary_semaphore blocked(0);
+				std::binary_semaphore unblock(0);
+				std::binary_semaphore done(0);
+				std::thread::id blockedThreadId;
+
+				aWorkQueue->PostWithAffinity(0, [&]()
+				{
+					blockedThreadId = std::this_thread::get_id();
+					blocked.release();
+					unblock.acquire();
+				});
+
+				blocked.acquire();
+
+				std::thread::id threadId;
+				aWorkQueue->PostWithAffinity(0, [&]()
+				{
+					threadId = std::this_thread::get_id();
+					done.release();
+				});
+
+				done.acquire();
+				assert(threadId != blockedThreadId);
+
+				unblock.release();
+			}
+		}
+
+		void
+		_TestWorkers(
+			nwork::ThreadPool*			aThreadPool)
+		{
+			// Every thread of the pool executes a broadcast once
+			std::mutex threadIdsLock;
+			std::vector<std::thread::id> threadIds;
+
+			aThreadPool->Broadcast([&]()
+			{
+				std::lock_guard lock(threadIdsLock);
+				threadIds.push_back(std::this_thread::get_id());
+			});
+
+			assert(threadIds.size() == aThreadPool->GetThreadCount());
+			assert(std::unordered_set<std::thread::id>(threadIds.begin(), threadIds.end()).size() == threadIds.size());
+
+			// Functions posted to a worker are all executed by the same thread, even when it's busy
+			{
+				std::binary_semaphore blocked(0);
+				std::binary_semaphore unblock(0);
+				std::thread::id blockedThreadId;
+				std::atomic_uint32_t mismatches = 0;
+				nwork::Group group;
+
+				aThreadPool->PostToWorkerWithGroup(3, &group, [&]()
+				{
+					blockedThreadId = std::this_thread::get_id();
+					blocked.release();
+					unblock.acquire();
+				});
+
+				blocked.acquire();
+
+				for(uint32_t i = 0; i < 100; i++)
+				{
+					aThreadPool->PostToWorkerWithGroup(3, &group, [&]()
+					{
+						if(std::this_thread::get_id() != blockedThreadId)
+							mismatches++;
+					});
+				}
+
+				unblock.release();
+				group.Wait();
+				assert(mismatches == 0);
+			}
+
+			// Broadcast from one of the workers
+			{
+				std::atomic_uint32_t count = 0;
+				nwork::Group group;
+
+				aThreadPool->PostToWorkerWithGroup(0, &group, [&]()
+				{
+					aThreadPool->Broadcast([&]() { count++; });
+				});
+
+				group.Wait();
+				assert(count == aThreadPool->GetThreadCount());
+			}
+
+			// Asynchronous broadcast
+			{
+				std::atomic_uint32_t count = 0;
+				nwork::Group group;
+				aThreadPool->BroadcastWithGroup(&group, [&]() { count++; });
+				group.Wait();
+				assert(count == aThreadPool->GetThreadCount());
+			}
+		}
+
+		void
+		_TestTopology()
+		{
+			nwork::Topology topology = nwork::Topology::Detect();
+			const std::vector<nwork::Topology::CPU>& cpus = topology.GetCPUs();
+			assert(!cpus.empty());
+
+			for(size_t i = 1; i < cpus.size(); i++)
+				assert(cpus[i - 1].m_packageId < cpus[i].m_packageId || cpus[i - 1].m_coreId <= cpus[i].m_coreId);
+
+			assert(topology.GetPhysicalCoreCount() >= 1 && topology.GetPhysicalCoreCount() <= topology.GetLogicalCPUCount());
+			assert(!topology.GetL3Ids().empty());
+			assert(nwork::GetCPUCount() == topology.GetUsableCPUCount());
+
+			// Same from a pinned thread
+			std::thread([&]()
+			{
+				bool ok = nwork::Topology::SetCurrentThreadAffinity({ cpus.back().m_id });
+				(void)ok;
+				assert(ok);
+				assert(nwork::Topology::Detect().GetLogicalCPUCount() == topology.GetLogicalCPUCount());
+			}).join();
+
+			// CPU quota limits usable CPUs
+			{
+				nwork::Topology simulated = nwork::Topology::Simulate(1, 4, 2);
+				assert(simulated.GetLogicalCPUCount() == 8);
+				assert(simulated.GetPhysicalCoreCount() == 4);
+				assert(simulated.GetUsableCPUCount() == 8);
+
+				simulated.SetCPUQuota(2.5);
+				assert(simulated.GetUsableCPUCount() == 3);
+
+				simulated.SetCPUQuota(0.1);
+				assert(simulated.GetUsableCPUCount() == 1);
+			}
+
+			// Pinned threads only run on their CPUs
+			{
+				// First logical CPU of every core, except the reserved one unless it's the only one
+				std::vector<uint32_t> expectedCPUIds;
+				const nwork::Topology::CPU* previous = NULL;
+
+				for(const nwork::Topology::CPU& cpu : cpus)
+				{
+					if(previous == NULL || !cpu.IsSameCore(*previous))
+						expectedCPUIds.push_back(cpu.m_id);
+
+					previous = &cpu;
+				}
+
+				if(expectedCPUIds.size() > 1)
+					expectedCPUIds.erase(expectedCPUIds.begin());
+
+				nwork::Queue workQueue;
+
+				nwork::ThreadPool::Options options;
+				options.m_numThreads = 4;
+				options.m_affinity = nwork::ThreadPool::AFFINITY_CPU;
+				options.m_skipSMTSiblings = true;
+				options.m_reservedCores = 1;
+				nwork::ThreadPool threadPool(&workQueue, options);
+
+				std::mutex cpuIdsLock;
+				std::vector<uint32_t> cpuIds;
+
+				threadPool.Broadcast([&]()
+				{
+					#if !defined(WIN32)
+						cpu_set_t cpuSet;
+						CPU_ZERO(&cpuSet);
+						int result = pthread_getaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+						(void)result;
+						assert(result == 0);
+						assert(CPU_COUNT(&cpuSet) == 1);
+
+						int cpuId = sched_getcpu();
+						assert(cpuId >= 0 && CPU_ISSET(cpuId, &cpuSet));
+
+						std::lock_guard lock(cpuIdsLock);
+						cpuIds.push_back((uint32_t)cpuId);
+					#endif
+				});
+
+				// Never on the reserved core or an SMT sibling, and spread over as many CPUs as possible
+				#if !defined(WIN32)
+					assert(cpuIds.size() == 4);
+
+					for(uint32_t cpuId : cpuIds)
+						assert(std::find(expectedCPUIds.begin(), expectedCPUIds.end(), cpuId) != expectedCPUIds.end());
+
+					assert(std::unordered_set<uint32_t>(cpuIds.begin(), cpuIds.end()).size() == std::min<size_t>(expectedCPUIds.size(), 4));
+				#endif
+			}
+
+			// Threads sharing an L3 cache
+			{
+				nwork::Queue workQueue;
+
+				nwork::ThreadPool::Options options;
+				options.m_numThreads = 2;
+				options.m_affinity = nwork::ThreadPool::AFFINITY_L3;
+				nwork::ThreadPool threadPool(&workQueue, options);
+
+				std::atomic_uint32_t count = 0;
+				threadPool.Broadcast([&]() { count++; });
+				assert(count == 2);
+			}
+
+			// Default thread count follows the usable cores and the CPU quota
+			{
+				nwork::Queue workQueue;
+
+				nwork::ThreadPool::Options options;
+				options.m_affinity = nwork::ThreadPool::AFFINITY_CORE;
+				options.m_skipSMTSiblings = true;
+				nwork::ThreadPool threadPool(&workQueue, options);
+
+				assert(threadPool.GetThreadCount() == std::min(topology.GetPhysicalCoreCount(), topology.GetUsableCPUCount()));
+			}
+		}
+
+		void
+		_TestElasticThreadPool()
+		{
+			for(size_t growQueueLength : { 2, 1000 })
+			{
+				nwork::Queue workQueue;
+
+				nwork::ThreadPool::Options options;
+				options.m_numThreads = 1;
+				options.m_maxThreads = 3;
+				options.m_growQueueLength = growQueueLength;
+				options.m_idleTimeout = std::chrono::milliseconds(20);
+				nwork::ThreadPool threadPool(&workQueue, options);
+
+				// Only thread is blocked, backed up packets are executed by extra threads, started either because of 
+				// the queue length or because of how long packets have waited
+				std::binary_semaphore unblock(0);
+				nwork::Group blockedGroup;
+				workQueue.PostFunctionWithGroup(&blockedGroup, [&]() { unblock.acquire(); });
+
+				std::atomic_uint32_t count = 0;
+				nwork::Group group;
+				for(uint32_t i = 0; i < 10; i++)
+					workQueue.PostFunctionWithGroup(&group, [&]() { count++; });
+
+				group.Wait();
+				assert(count == 10);
+				assert(threadPool.GetExtraThreadCount() > 0);
+
+				unblock.release();
+				blockedGroup.Wait();
+
+				// Extra threads stop after being idle
+				while(threadPool.GetExtraThreadCount() > 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+		}
+
+		void
+		_TestBlockingScope()
+		{
+			{
+				// Not a thread pool thread
+				nwork::BlockingScope blockingScope;
+				assert(nwork::ThreadPool::GetCurrent() == NULL);
+			}
+
+			nwork::Queue workQueue;
+
+			nwork::ThreadPool::Options options;
+			options.m_numThreads = 1;
+			options.m_idleTimeout = std::chrono::milliseconds(20);
+			nwork::ThreadPool threadPool(&workQueue, options);
+
+			// Only thread blocks, another one takes over
+			std::binary_semaphore blocked(0);
+			std::binary_semaphore unblock(0);
+			nwork::Group blockedGroup;
+
+			workQueue.PostFunctionWithGroup(&blockedGroup, [&]()
+			{
+				assert(nwork::ThreadPool::GetCurrent() == &threadPool);
+
+				nwork::BlockingScope blockingScope;
+				nwork::BlockingScope nestedBlockingScope;
+				blocked.release();
+				unblock.acquire();
+			});
+
+			blocked.acquire();
+			assert(threadPool.GetBlockedThreadCount() == 1);
+			assert(threadPool.GetExtraThreadCount() == 1);
+
+			std::atomic_uint32_t count = 0;
+			nwork::Group group;
+			for(uint32_t i = 0; i < 10; i++)
+				workQueue.PostFunctionWithGroup(&group, [&]() { count++; });
+
+			group.Wait();
+			assert(count == 10);
+
+			unblock.release();
+			blockedGroup.Wait();
+			assert(threadPool.GetBlockedThreadCount() == 0);
+
+			while(threadPool.GetExtraThreadCount() > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+
+		void
+		_TestStop()
+		{
+			// Stop packets are only returned to the outermost loop
+			{
+				nwork::Queue workQueue;
+				workQueue.SetWorkerCount(1);
+				workQueue.AttachWorker(0);
+
+				bool executed = false;
+				workQueue.PostFunction([&]()
+				{
+					workQueue.PostPacketToWorker(0, nwork::Queue::MakeStopPacket());
+					assert(workQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_TIMED_OUT);
+
+					// Kept aside rather than posted again, so helping doesn't keep taking it
+					assert(workQueue.GetLocalPacketCount() == 0);
+					assert(workQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_TIMED_OUT);
+
+					bool helped = false;
+					workQueue.PostFunctionToWorker(0, [&]() { helped = true; });
+					assert(workQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_OK);
+					assert(helped);
+
+					executed = true;
+				});
+
+				assert(workQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_OK);
+				assert(executed);
+				assert(workQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_STOPPED);
+				assert(workQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_TIMED_OUT);
+
+				workQueue.DetachWorker();
+			}
+
+			// Idle threads are woken up to stop, instead of sleeping forever
+			{
+				nwork::Queue workQueue;
+				nwork::ThreadPool threadPool(&workQueue, 4);
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				threadPool.Stop();
+				assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+				// Nothing left behind for the next pool
+				nwork::ThreadPool nextThreadPool(&workQueue, 4);
+				std::atomic_uint32_t count = 0;
+				nextThreadPool.Broadcast([&]() { count++; });
+				assert(count == 4);
+			}
+
+			// Draining executes everything posted before stopping
+			{
+				nwork::Queue workQueue;
+				nwork::ThreadPool threadPool(&workQueue, 2);
+
+				std::atomic_uint32_t count = 0;
+				for(uint32_t i = 0; i < 1000; i++)
+					workQueue.PostFunction([&]() { count++; });
+
+				for(uint32_t i = 0; i < 100; i++)
+					threadPool.PostToWorker(i % 2, [&]() { count++; });
+
+				for(uint32_t i = 0; i < 100; i++)
+					workQueue.PostWithAffinity(i, [&]() { count++; });
+
+				threadPool.Stop(nwork::ThreadPool::STOP_MODE_DRAIN);
+				assert(count == 1200);
+			}
+
+			// Packets left for a detached worker aren't lost
+			{
+				nwork::Queue workQueue;
+				workQueue.SetWorkerCount(2);
+
+				std::atomic_uint32_t count = 0;
+
+				std::thread([&]()
+				{
+					workQueue.AttachWorker(0);
+
+					workQueue.PostFunctionToWorker(0, [&]() { count++; });
+					for(uint32_t i = 0; i < 100; i++)
+						workQueue.PostWithAffinity(i, [&]() { count++; });
+
+					workQueue.DetachWorker();
+				}).join();
+
+				workQueue.PostWithAffinity(0, [&]() { count++; });
+				assert(workQueue.GetQueuedPacketCount() == 102);
+
+				while(workQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_OK)
+					;
+
+				assert(count == 102);
+			}
+		}
+
+		void
+		_TestWakePolicy()
+		{
+			nwork::Queue workQueue;
+
+			nwork::ThreadPool::Options options;
+			options.m_numThreads = 4;
+			options.m_wakePolicy = nwork::Queue::WAKE_POLICY_LIFO;
+			nwork::ThreadPool threadPool(&workQueue, options);
+			assert(workQueue.GetWakePolicy() == nwork::Queue::WAKE_POLICY_LIFO);
+
+			// One packet at a time is executed by the thread that went idle last, which is the same one every time. Wait 
+			// for it to go back to sleep before posting the next one, so it doesn't pick it up before that.
+			std::unordered_set<std::thread::id> threadIds;
+
+			for(uint32_t i = 0; i < 100; i++)
+			{
+				while(workQueue.GetParkedWorkerCount() < 4)
+					std::this_thread::yield();
+
+				nwork::Group group;
+				workQueue.PostFunctionWithGroup(&group, [&]() { threadIds.insert(std::this_thread::get_id()); });
+				group.Wait();
+			}
+
+			assert(threadIds.size() == 1);
+
+			// Everything is still executed when all threads are needed
+			std::atomic_uint32_t count = 0;
+			std::vector<std::function<void()>> functions(1000, [&]() { count++; });
+
+			nwork::Group group;
+			workQueue.PostFunctionsWithGroup(&group, functions);
+			for(uint32_t i = 0; i < 1000; i++)
+				workQueue.PostFunctionWithGroup(&group, [&]() { count++; });
+
+			group.Wait();
+			assert(count == 2000);
+		}
+
+		void
+		_TestBusyPoll()
+		{
+			for(nwork::Queue::WakePolicy wakePolicy : { nwork::Queue::WAKE_POLICY_ANY, nwork::Queue::WAKE_POLICY_LIFO })
+			{
+				nwork::Queue workQueue;
+
+				nwork::ThreadPool::Options options;
+				options.m_numThreads = 2;
+				options.m_wakePolicy = wakePolicy;
+				options.m_spinBudget = std::chrono::milliseconds(1);
+				nwork::ThreadPool threadPool(&workQueue, options);
+
+				std::atomic_uint32_t count = 0;
+
+				// Posted while a thread is spinning or just after it went to sleep
+				for(uint32_t i = 0; i < 100; i++)
+				{
+					nwork::Group group;
+					workQueue.PostFunctionWithGroup(&group, [&]() { count++; });
+					group.Wait();
+
+					if(i % 10 == 0)
+						std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				}
+
+				std::vector<std::function<void()>> functions(1000, [&]() { count++; });
+				nwork::Group group;
+				workQueue.PostFunctionsWithGroup(&group, functions);
+				group.Wait();
+
+				assert(count == 1100);
+
+				// Packet waiting for another one, posted together while one thread is spinning and the other one might
+				// be asleep, so the spinning thread can't take both
+				for(uint32_t i = 0; i < 200; i++)
+				{
+					std::binary_semaphore released(0);
+					std::atomic_bool waited = false;
+
+					std::vector<std::function<void()>> dependentFunctions;
+					dependentFunctions.push_back([&]() { waited = released.try_acquire_for(std::chrono::seconds(5)); });
+					dependentFunctions.push_back([&]() { released.release(); });
+
+					nwork::Group dependentGroup;
+					workQueue.PostFunctionsWithGroup(&dependentGroup, dependentFunctions);
+					dependentGroup.Wait();
+					assert(waited);
+
+					std::this_thread::sleep_for(std::chrono::microseconds((i % 10) * 200));
+				}
+
+				// Spinning threads notice when the pool stops
+				threadPool.Stop();
+			}
+		}
+
+		void
+		_TestNUMA()
+		{
+			nwork::Topology topology = nwork::Topology::Simulate(2, 2, 2);
+			assert(topology.GetNodeIds() == std::vector<uint32_t>({ 0, 1 }));
+			assert(topology.GetCPUIdsOfNode(1) == std::vector<uint32_t>({ 4, 5, 6, 7 }));
+
+			// Idle queue takes work from a remote one
+			{
+				nwork::Queue localQueue;
+				nwork::Queue remoteQueue;
+				localQueue.SetRemoteQueues({ &remoteQueue });
+
+				bool executed = false;
+				remoteQueue.PostFunction([&]() { executed = true; });
+
+				assert(localQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_OK);
+				assert(executed);
+				assert(remoteQueue.WaitAndExecute(0) == nwork::Queue::WAIT_RESULT_TIMED_OUT);
+			}
+
+			nwork::NUMAThreadPool threadPool(topology, 2);
+			assert(threadPool.GetNodeCount() == 2);
+
+			// Workers know their node, so what they post goes to its queue. Idle threads of the other node could take it 
+			// from there, so only where it was posted is checked.
+			{
+				std::atomic_size_t nodeIndex = SIZE_MAX;
+				std::atomic_bool executed = false;
+				nwork::Group group;
+
+				uint64_t postedCount0 = threadPool.GetQueue(0)->GetPostedPacketCount();
+				uint64_t postedCount1 = threadPool.GetQueue(1)->GetPostedPacketCount();
+
+				// Worker inboxes aren't shared with other nodes
+				threadPool.GetQueue(1)->PostFunctionToWorkerWithGroup(0, &group, [&]()
+				{
+					nodeIndex = threadPool.GetLocalNodeIndex();
+					assert(threadPool.GetLocalQueue() == threadPool.GetQueue(1));
+
+					threadPool.PostFunctionWithGroup(&group, [&]() { executed = true; });
+				});
+
+				group.Wait();
+				assert(nodeIndex == 1);
+				assert(executed);
+				assert(threadPool.GetQueue(0)->GetPostedPacketCount() == postedCount0);
+				assert(threadPool.GetQueue(1)->GetPostedPacketCount() == postedCount1 + 1);
+			}
+
+			// Every item is processed once
+			for(uint32_t pass = 0; pass < 3; pass++)
+			{
+				std::vector<std::atomic_uint32_t> counts(1000);
+				threadPool.ForEachInRange(0, 999, [&](int32_t aIndex) { counts[aIndex]++; });
+
+				for(const std::atomic_uint32_t& count : counts)
+					assert(count == 1);
+			}
+
+			threadPool.ForEachInRange(5, 5, [&](int32_t aIndex) { assert(aIndex == 5); });
+
+			// Node that was already asleep is woken up to help with a backlog on another one
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+				std::atomic_uint32_t remoteCount = 0;
+				nwork::Group group;
+
+				for(uint32_t i = 0; i < 16; i++)
+				{
+					threadPool.GetQueue(0)->PostFunctionWithGroup(&group, [&]()
+					{
+						if(threadPool.GetLocalNodeIndex() == 1)
+							remoteCount++;
+
+						std::this_thread::sleep_for(std::chrono::milliseconds(20));
+					});
+				}
+
+				group.Wait();
+				assert(remoteCount > 0);
+			}
+		}
+
+		void
+		_TestPipeline(
+			nwork::Queue*				aWorkQueue)
+		{
+			for(size_t maxTokens = 1; maxTokens <= 8; maxTokens++)
+			{
+				std::vector<uint32_t> items(maxTokens);
+				std::vector<uint32_t> applied;
+				std::atomic_bool validating = false;
+				std::atomic_uint32_t validated = 0;
+				uint32_t nextItem = 0;
+
+				nwork::Pipeline pipeline(aWorkQueue);
+
+				// Decode
+				pipeline.AddStage(nwork::Pipeline::STAGE_MODE_PARALLEL, [&](
+					size_t aToken)
+				{
+					assert(aToken < maxTokens);
+					items[aToken] *= 2;
+				});
+
+				// Validate
+				pipeline.AddStage(nwork::Pipeline::STAGE_MODE_SERIAL_OUT_OF_ORDER, [&](
+					size_t aToken)
+				{
+					assert(!validating.exchange(true));
+					assert(items[aToken] % 2 == 0);
+					validated++;
+					validating = false;
+				});
+
+				// Apply
+				pipeline.AddStage(nwork::Pipeline::STAGE_MODE_SERIAL_IN_ORDER, [&](
+					size_t aToken)
+				{
+					applied.push_back(items[aToken]);
+				});
+
+				pipeline.Run(maxTokens, [&](
+					size_t aToken) -> bool
+				{
+					if(nextItem == 1000)
+						return false;
+
+					items[aToken] = nextItem++;
+					return true;
+				});
+
+				assert(validated == 1000);
+				assert(applied.size() == 1000);
+
+				for(uint32_t i = 0; i < 1000; i++)
+					assert(applied[i] == i * 2);
+			}
+		}
+
+		void
+		_TestReferences()
+		{
+			struct TestObject
+			{
+				void
+				AddReference()
+				{
+					m_refCount++;
+				}
+
+				void
+				RemoveReference()
+				{
+					if(--m_refCount == 0)
+					{
+						assert(!m_deleted);
+						m_deleted = true;
+					}
+				}
+
+				uint32_t				m_refCount = 0;
+				bool					m_deleted = false;
+			};
+
+			{
+				TestObject x;
+
+				{
+					nwork::Reference<TestObject> p(&x);
+					assert(!x.m_deleted);
+					assert(x.m_refCount == 1);
+				}
+
+				assert(x.m_deleted);
+			}
+
+			{
+				TestObject x;
+
+				{
+					nwork::Reference<TestObject> p(&x);
+					assert(!x.m_deleted);
+					assert(x.m_refCount == 1);
+
+					nwork::Reference<TestObject> a = p;
+					assert(!x.m_deleted);
+					assert(x.m_refCount == 2);
+
+					assert(a == p);
+					a.Release();
+
+					assert(!x.m_deleted);
+					assert(x.m_refCount == 1);
+
+					assert(a.IsNull());
+					assert(!p.IsNull());
+
+					nwork::Reference<TestObject> b = std::move(p);
+					assert(!x.m_deleted);
+					assert(x.m_refCount == 1);
+
+					assert(!b.IsNull());
+					assert(p.IsNull());
+				}
+
+				assert(x.m_deleted);
+			}
+
+		}
+	}
+
+	void
+	Run()
+	{
+		{
+			nwork::Queue workQueue;
+			nwork::ThreadPool threadPool(&workQueue, 8);
+
+			_TestFunctions(&workQueue);
+			_TestObjects(&workQueue);
+			_TestForEach(&workQueue);
+			_TestGroups(&workQueue);
+			_TestPipeline(&workQueue);
+			_TestInvoke(&workQueue);
+			_TestFutures(&workQueue);
+			_TestTasks(&workQueue);
+			_TestTaskGraph(&workQueue);
+			_TestStrands(&workQueue);
+			_TestMailboxObjects(&workQueue);
+			_TestAffinity(&workQueue);
+			_TestWorkers(&threadPool);
+			_TestReferences();
+		}
+
+		_TestTopology();
+		_TestNUMA();
+		_TestElasticThreadPool();
+		_TestBlockingScope();
+		_TestStop();
+		_TestWakePolicy();
+		_TestBusyPoll();
+
+		_TestFibers();
 	}
 
 }